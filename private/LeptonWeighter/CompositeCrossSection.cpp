@@ -0,0 +1,130 @@
+#include <LeptonWeighter/CompositeCrossSection.h>
+#include <stdexcept>
+
+namespace LW {
+
+const size_t CompositeCrossSection::max_components;
+
+namespace {
+
+uint64_t checked_route(const CompositeCrossSection& cs, const Event& e){
+    uint64_t route = cs.route(e.primary_type,e.final_state_particle_0,e.final_state_particle_1);
+    if(route == 0)
+        throw std::runtime_error("CompositeCrossSection: no cross section for the primary and final state of the event.");
+    return route;
+}
+
+} // namespace
+
+size_t CompositeCrossSection::add(std::shared_ptr<const CrossSection> cs,
+        ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1){
+    if(not cs)
+        throw std::runtime_error("CompositeCrossSection: null cross section.");
+    if(components.size() == max_components)
+        throw std::runtime_error("CompositeCrossSection: too many components.");
+    components.push_back(cs);
+    add_channel(components.size()-1,primary,final_state_particle_0,final_state_particle_1);
+    return components.size()-1;
+}
+
+void CompositeCrossSection::add_channel(size_t component, ParticleType primary,
+        ParticleType final_state_particle_0, ParticleType final_state_particle_1){
+    if(component >= components.size())
+        throw std::runtime_error("CompositeCrossSection: no component with that index.");
+    Channel c;
+    c.primary = primary;
+    c.final_state_particle_0 = final_state_particle_0;
+    c.final_state_particle_1 = final_state_particle_1;
+    c.specificity = (primary != ParticleType::unknown)+(final_state_particle_0 != ParticleType::unknown)+(final_state_particle_1 != ParticleType::unknown);
+    c.component = component;
+    channels.push_back(c);
+}
+
+std::shared_ptr<CompositeCrossSection> CompositeCrossSection::MakeDISAndGlashowResonance(std::shared_ptr<const CrossSection> dis,
+        std::shared_ptr<const CrossSection> glashow_resonance){
+    using PT=ParticleType;
+    std::shared_ptr<CompositeCrossSection> cs = std::make_shared<CompositeCrossSection>();
+    cs->add(dis,PT::unknown,PT::Hadrons);
+    size_t gr = cs->add(glashow_resonance,PT::NuEBar,PT::EMinus,PT::NuEBar);
+    cs->add_channel(gr,PT::NuEBar,PT::MuMinus,PT::NuMuBar);
+    cs->add_channel(gr,PT::NuEBar,PT::TauMinus,PT::NuTauBar);
+    cs->add_channel(gr,PT::NuEBar,PT::Hadrons,PT::Hadrons);
+    return cs;
+}
+
+uint64_t CompositeCrossSection::route(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1) const {
+    uint64_t route = 0;
+    unsigned int best = 0;
+    for(const Channel& c : channels){
+        if(not matches(c.primary,primary))
+            continue;
+        // the final states are an unordered pair
+        if(not ((matches(c.final_state_particle_0,final_state_particle_0) and matches(c.final_state_particle_1,final_state_particle_1)) or
+                (matches(c.final_state_particle_0,final_state_particle_1) and matches(c.final_state_particle_1,final_state_particle_0))))
+            continue;
+        if(c.specificity > best or route == 0){
+            best = c.specificity;
+            route = 0;
+        }
+        if(c.specificity == best)
+            route |= uint64_t(1) << c.component;
+    }
+    return route;
+}
+
+double CompositeCrossSection::DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const {
+    uint64_t route = this->route(pt,finalstate_0,finalstate_1);
+    if(route == 0)
+        throw std::runtime_error("CompositeCrossSection: no cross section for the primary and final state of the event.");
+    double cross_section = 0;
+    for(size_t i=0; i<components.size(); i++){
+        if(route >> i & 1)
+            cross_section += components[i]->DoubleDifferentialCrossSection(pt,finalstate_0,finalstate_1,energy,x,y);
+    }
+    return cross_section;
+}
+
+double CompositeCrossSection::DoubleDifferentialCrossSection(const PreparedEvent& e) const {
+    uint64_t route = checked_route(*this,e);
+    double cross_section = 0;
+    for(size_t i=0; i<components.size(); i++){
+        if(route >> i & 1)
+            cross_section += components[i]->DoubleDifferentialCrossSection(e);
+    }
+    return cross_section;
+}
+
+void CompositeCrossSection::DoubleDifferentialCrossSectionBatch(const Event* events, size_t n, double* out) const {
+    std::vector<uint64_t> routes(n);
+    for(size_t i=0; i<n; i++){
+        routes[i] = checked_route(*this,events[i]);
+        out[i] = 0;
+    }
+    std::vector<size_t> selected;
+    std::vector<Event> component_events;
+    std::vector<double> values;
+    for(size_t c=0; c<components.size(); c++){
+        selected.clear();
+        for(size_t i=0; i<n; i++){
+            if(routes[i] >> c & 1)
+                selected.push_back(i);
+        }
+        if(selected.empty())
+            continue;
+        // events that all go to this component need no copy
+        if(selected.size() == n){
+            values.resize(n);
+            components[c]->DoubleDifferentialCrossSectionBatch(events,n,values.data());
+        } else {
+            component_events.clear();
+            for(size_t i : selected)
+                component_events.push_back(events[i]);
+            values.resize(selected.size());
+            components[c]->DoubleDifferentialCrossSectionBatch(component_events.data(),component_events.size(),values.data());
+        }
+        for(size_t k=0; k<selected.size(); k++)
+            out[selected[k]] += values[k];
+    }
+}
+
+} // namespace LW
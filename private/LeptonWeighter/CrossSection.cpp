@@ -1,15 +1,23 @@
 #include <LeptonWeighter/CrossSection.h>
+#include <LeptonWeighter/SplineRegistry.h>
+#include <SQuIDS/const.h>
 #include <math.h>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <limits>
 
 namespace LW {
 
+void CrossSection::DoubleDifferentialCrossSectionBatch(const Event* events, size_t n, double* out) const {
+    for(size_t i=0; i<n; i++)
+        out[i] = (*this)(events[i]);
+}
+
 bool CrossSectionFromSpline::is_charged_lepton(ParticleType p) const {
-    using PT=ParticleType;
-    if(p == PT::EPlus or p == PT::EMinus or p == PT::MuPlus or p == PT::MuMinus or p == PT::TauPlus or p == PT::TauMinus)
-        return true;
-    return false;
+    return LW::is_charged_lepton(p);
 }
 
 double CrossSectionFromSpline::DoubleDifferentialCrossSection(ParticleType particle, ParticleType f0, ParticleType f1, double nuEnergy,double x, double y) const {
@@ -51,58 +59,267 @@ double CrossSectionFromSpline::DoubleDifferentialCrossSection(ParticleType parti
     return msq_tocmsq*diffxs;
 }
 
+double CrossSectionFromSpline::DoubleDifferentialCrossSection(const PreparedEvent& e) const {
+    if(not (e.neutrino or e.antineutrino))
+        throw std::runtime_error("CrossSection:CalDDXSPhotoSpline : Bad PDG type.");
+
+    int centerbuffer[3];
+    double xx[3] = {e.log10_energy, e.log10_interaction_x, e.log10_interaction_y};
+    const splinetable& table = e.neutrino ? (e.charged_current ? *nu_CC_dsdxdy : *nu_NC_dsdxdy)
+                                          : (e.charged_current ? *nubar_CC_dsdxdy : *nubar_NC_dsdxdy);
+
+    double diffxs=0;
+    if(table.searchcenters(xx,centerbuffer))
+        diffxs += pow(10.0,table.ndsplineeval(xx,centerbuffer,0));
+
+    return msq_tocmsq*diffxs;
+}
+
 CrossSectionFromSpline::CrossSectionFromSpline(
         std::string differential_neutrino_CC_xs_spline_path, std::string differential_antineutrino_CC_xs_spline_path,
-        std::string differential_neutrino_NC_xs_spline_path, std::string differential_antineutrino_NC_xs_spline_path):
-    nu_CC_dsdxdy(new photospline::splinetable<>),
-    nubar_CC_dsdxdy(new photospline::splinetable<>),
-    nu_NC_dsdxdy(new photospline::splinetable<>),
-    nubar_NC_dsdxdy(new photospline::splinetable<>)
+        std::string differential_neutrino_NC_xs_spline_path, std::string differential_antineutrino_NC_xs_spline_path)
 {
-    if(not nu_CC_dsdxdy->read_fits(differential_neutrino_CC_xs_spline_path))
+    SplineRegistry& registry = SplineRegistry::global();
+    nu_CC_dsdxdy = registry.get_file(differential_neutrino_CC_xs_spline_path);
+    if(not nu_CC_dsdxdy)
         throw std::runtime_error("Error loading differential CC neutrino the spline.");
 
-    if(not nubar_CC_dsdxdy->read_fits(differential_antineutrino_CC_xs_spline_path))
+    nubar_CC_dsdxdy = registry.get_file(differential_antineutrino_CC_xs_spline_path);
+    if(not nubar_CC_dsdxdy)
         throw std::runtime_error("Error loading differential CC antineutrino spline.");
 
-    if(not nu_NC_dsdxdy->read_fits(differential_neutrino_NC_xs_spline_path))
+    nu_NC_dsdxdy = registry.get_file(differential_neutrino_NC_xs_spline_path);
+    if(not nu_NC_dsdxdy)
         throw std::runtime_error("Error loading differential NC neutrino the spline.");
 
-    if(not nubar_NC_dsdxdy->read_fits(differential_antineutrino_NC_xs_spline_path))
+    nubar_NC_dsdxdy = registry.get_file(differential_antineutrino_NC_xs_spline_path);
+    if(not nubar_NC_dsdxdy)
         throw std::runtime_error("Error loading differential NC antineutrino spline.");
+
+    batch_evaluators.emplace_back(*nu_CC_dsdxdy);
+    batch_evaluators.emplace_back(*nubar_CC_dsdxdy);
+    batch_evaluators.emplace_back(*nu_NC_dsdxdy);
+    batch_evaluators.emplace_back(*nubar_NC_dsdxdy);
 }
 
+namespace {
 
-double GlashowResonanceCrossSection::DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const {
-  if(pt == ParticleType::NuEBar){
+// events per pass of the batch evaluation
+const size_t cross_section_block = 256;
+
+} // namespace
+
+void CrossSectionFromSpline::DoubleDifferentialCrossSectionBatch(const Event* events, size_t n, double* out) const {
+    DoubleDifferentialCrossSectionBatch(events,n,out,SplinePrecision::Double);
+}
+
+void CrossSectionFromSpline::DoubleDifferentialCrossSectionBatch(const Event* events, size_t n, double* out, SplinePrecision precision) const {
+    double log_coordinates[3][cross_section_block];
+    double values[cross_section_block];
+    bool in_range[cross_section_block];
+    size_t table_events[4][cross_section_block];
+    for(size_t begin=0; begin<n; begin+=cross_section_block){
+        const size_t block = std::min(cross_section_block,n-begin);
+        // sort the events by table as DoubleDifferentialCrossSection picks them
+        size_t n_table_events[4] = {0,0,0,0};
+        for(size_t i=0; i<block; i++){
+            const Event& e = events[begin+i];
+            const ParticleType particle = e.primary_type;
+            size_t table;
+            if (particle == ParticleType::NuE or particle == ParticleType::NuMu or particle == ParticleType::NuTau)
+                table = 0;
+            else if (particle == ParticleType::NuEBar or particle == ParticleType::NuMuBar or particle == ParticleType::NuTauBar)
+                table = 1;
+            else
+                throw std::runtime_error("CrossSection:CalDDXSPhotoSpline : Bad PDG type.");
+            if(not (is_charged_lepton(e.final_state_particle_0) or is_charged_lepton(e.final_state_particle_1)))
+                table += 2;
+            table_events[table][n_table_events[table]++] = i;
+        }
+
+        for(size_t table=0; table<4; table++){
+            const size_t m = n_table_events[table];
+            if(m == 0)
+                continue;
+            for(size_t k=0; k<m; k++){
+                const Event& e = events[begin+table_events[table][k]];
+                log_coordinates[0][k] = log10(e.energy);
+                log_coordinates[1][k] = log10(e.interaction_x);
+                log_coordinates[2][k] = log10(e.interaction_y);
+            }
+            const double* coordinates[3] = {log_coordinates[0],log_coordinates[1],log_coordinates[2]};
+            batch_evaluators[table].evaluate(coordinates,m,values,in_range,precision);
+            for(size_t k=0; k<m; k++){
+                double diffxs = in_range[k] ? pow(10.0,values[k]) : 0.;
+                out[begin+table_events[table][k]] = msq_tocmsq*diffxs;
+            }
+        }
+    }
+}
+
+uint64_t CrossSectionFromSpline::max_batch_ulp_difference(const Event* events, size_t n) const {
+    std::vector<double> batch(n);
+    DoubleDifferentialCrossSectionBatch(events,n,batch.data(),SplinePrecision::Double);
+    uint64_t max_difference = 0;
+    for(size_t i=0; i<n; i++){
+        const Event& e = events[i];
+        const double reference = DoubleDifferentialCrossSection(e.primary_type,e.final_state_particle_0,e.final_state_particle_1,
+                e.energy,e.interaction_x,e.interaction_y);
+        max_difference = std::max(max_difference,ulp_distance(batch[i],reference));
+    }
+    return max_difference;
+}
+
+SinglePrecisionAccuracy CrossSectionFromSpline::check_single_precision(const Event* events, size_t n, double tolerance) const {
+    std::vector<double> reference(n), single(n);
+    DoubleDifferentialCrossSectionBatch(events,n,reference.data(),SplinePrecision::Double);
+    DoubleDifferentialCrossSectionBatch(events,n,single.data(),SplinePrecision::Single);
+    SinglePrecisionAccuracy accuracy;
+    double sum_relative_error = 0;
+    for(size_t i=0; i<n; i++){
+        // both are zero outside the tables
+        if(reference[i] == 0 and single[i] == 0)
+            continue;
+        double relative_error = reference[i] != 0 ? std::abs(single[i]-reference[i])/std::abs(reference[i]) : std::abs(single[i]);
+        accuracy.max_relative_error = std::max(accuracy.max_relative_error,relative_error);
+        sum_relative_error += relative_error;
+        accuracy.n_samples++;
+    }
+    if(accuracy.n_samples != 0)
+        accuracy.mean_relative_error = sum_relative_error/accuracy.n_samples;
+    accuracy.accepted = accuracy.n_samples != 0 and accuracy.max_relative_error <= tolerance;
+    return accuracy;
+}
+
+
+namespace {
+
+//K. Olive et al. (PDG), Chin. Phys. C38, 090001 (2014)
+const double b_muon = 0.1063;
+const double b_elec = 0.1071;
+const double b_tau  = 0.1138;
+const double b_hadr = 0.6741;
+
+// adds the deviation of the closed form from nuSQuIDS at one point; a NaN deviation counts as
+// infinite, so that it is never accepted
+void add_deviation(GlashowResonanceAccuracy& accuracy, double& sum_relative_error, double closed, double exact){
+    double relative_error = exact != 0 ? std::abs(closed-exact)/std::abs(exact) : std::abs(closed);
+    if(std::isnan(relative_error))
+        relative_error = std::numeric_limits<double>::infinity();
+    accuracy.max_relative_error = std::max(accuracy.max_relative_error,relative_error);
+    sum_relative_error += relative_error;
+    accuracy.n_samples++;
+}
+
+} // namespace
+
+GlashowResonanceCrossSection::GlashowResonanceCrossSection():closed_form(false){
+    // same products as the scale the cross section used to build on every call
+    const double scale = 1.0/b_muon;
+    final_state_scale[0] = scale*b_elec;
+    final_state_scale[1] = scale*b_muon;
+    final_state_scale[2] = scale*b_tau;
+    final_state_scale[3] = scale*b_hadr;
+    final_state_scale[4] = scale;
+
+    // the same Fermi constant and lepton masses as nuSQuIDS, which takes them from SQuIDS in eV units
+    const squids::Const units;
+    const double GF = units.GF*units.GeV*units.GeV;
+    const double electron_mass = units.electron_mass/units.GeV;
+    const double muon_mass = units.muon_mass/units.GeV;
+    // (hbar c)^2 in cm^2 GeV^2
+    const double hbarc2 = 1./(units.cm*units.cm*units.GeV*units.GeV);
+    using Constants::W_mass;
+    using Constants::W_width;
+    // dsigma/dy/E in cm^2/GeV, divided by GeV to get nuSQuIDS' cm^2/eV
+    resonance.coefficient = cm2_to_m2*2.*GF*GF*electron_mass/M_PI*hbarc2/units.GeV;
+    resonance.inverse_resonance_energy = 2.*electron_mass/(W_mass*W_mass);
+    resonance.width_term = W_width*W_width/(W_mass*W_mass);
+    resonance.muon_threshold = (muon_mass*muon_mass-electron_mass*electron_mass)/(2.*electron_mass);
+}
+
+GlashowResonanceAccuracy GlashowResonanceCrossSection::enable_closed_form(double tolerance){
+    // a grid across the resonance, which sits at 6.3 PeV
+    GlashowResonanceAccuracy accuracy;
+    double sum_relative_error = 0;
+    for(unsigned int i=0; i<=300; i++){
+        const double energy = pow(10.,5.+3.*i/300.);
+        for(unsigned int k=0; k<=20; k++){
+            const double y = 0.001+0.998*k/20.;
+            add_deviation(accuracy,sum_relative_error,resonance(energy,y),cm2_to_m2*nusquids_cross_section(energy,y));
+        }
+    }
+    accuracy.mean_relative_error = sum_relative_error/accuracy.n_samples;
+    accuracy.accepted = accuracy.max_relative_error <= tolerance;
+    closed_form = accuracy.accepted;
+    return accuracy;
+}
+
+unsigned int GlashowResonanceCrossSection::final_state_index(ParticleType finalstate_0){
+    switch(finalstate_0){
+        case ParticleType::EMinus: case ParticleType::NuEBar: return 0;
+        case ParticleType::MuMinus: case ParticleType::NuMuBar: return 1;
+        case ParticleType::TauMinus: case ParticleType::NuTauBar: return 2;
+        case ParticleType::Hadrons: return 3;
+        default: return 4;
+    }
+}
+
+double GlashowResonanceCrossSection::nusquids_cross_section(double energy, double y) const {
     // GR support comes from nusquids. CAD
     using namespace nusquids;
     double GeV = 1.e9;
     double e_out = (1-y)*energy;
-    double cm2_to_m2 = 1.e-4; //convert from nuSQuIDs units to LW units!
-    
-    //K. Olive et al. (PDG), Chin. Phys. C38, 090001 (2014)
-    double b_muon = 0.1063;
-    double b_elec = 0.1071;
-    double b_tau  = 0.1138;
-    double b_hadr = 0.6741;
-    double scale = 1.0/b_muon;
-
-    if (finalstate_0 == ParticleType::EMinus || finalstate_0 == ParticleType::NuEBar){
-        scale*=b_elec;
-    }else if (finalstate_0 == ParticleType::MuMinus || finalstate_0 == ParticleType::NuMuBar){
-        scale*=b_muon;
-    }else if (finalstate_0 == ParticleType::TauMinus || finalstate_0 == ParticleType::NuTauBar){
-        scale*=b_tau;
-    }else if (finalstate_0 == ParticleType::Hadrons){
-        scale*=b_hadr;
+    return grxs.SingleDifferentialCrossSection(energy*GeV,e_out*GeV,
+            NeutrinoCrossSections::electron,NeutrinoCrossSections::antineutrino,NeutrinoCrossSections::GR);
+}
+
+double GlashowResonanceCrossSection::DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const {
+    if(pt != ParticleType::NuEBar)
+        return 0.;
+    const double scale = final_state_scale[final_state_index(finalstate_0)];
+    if(closed_form)
+        return scale*resonance(energy,y);
+    return scale*cm2_to_m2*nusquids_cross_section(energy,y);
+}
+
+void GlashowResonanceCrossSection::DoubleDifferentialCrossSectionBatch(const Event* events, size_t n, double* out) const {
+    if(not closed_form){
+        CrossSection::DoubleDifferentialCrossSectionBatch(events,n,out);
+        return;
+    }
+    // Gather the inputs first. Events without a cross section get a zero scale and a harmless
+    // point, so that the arithmetic runs over contiguous arrays without any test.
+    double energy[cross_section_block], y[cross_section_block], scale[cross_section_block];
+    // a local copy, which the compiler knows out does not alias
+    const Resonance shape = resonance;
+    for(size_t begin=0; begin<n; begin+=cross_section_block){
+        const size_t block = std::min(cross_section_block,n-begin);
+        for(size_t i=0; i<block; i++){
+            const Event& e = events[begin+i];
+            const bool inside = e.primary_type == ParticleType::NuEBar and shape.inside(e.energy,e.interaction_y);
+            energy[i] = inside ? e.energy : 2.*shape.muon_threshold;
+            y[i] = inside ? e.interaction_y : 0.;
+            scale[i] = inside ? final_state_scale[final_state_index(e.final_state_particle_0)] : 0.;
+        }
+        for(size_t i=0; i<block; i++)
+            out[begin+i] = scale[i]*shape.value(energy[i],y[i]);
     }
+}
 
-    return scale*cm2_to_m2*grxs.SingleDifferentialCrossSection(energy*GeV,e_out*GeV,
-            NeutrinoCrossSections::electron,NeutrinoCrossSections::antineutrino,NeutrinoCrossSections::GR);
-  } else {
-    return 0.;
-  }
+GlashowResonanceAccuracy GlashowResonanceCrossSection::validate(unsigned int n_samples, double energy_min, double energy_max, unsigned int seed) const {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.,1.);
+    GlashowResonanceAccuracy accuracy;
+    double sum_relative_error = 0;
+    for(unsigned int s=0; s<n_samples; s++){
+        const double energy = energy_min*pow(energy_max/energy_min,uniform(rng));
+        const double y = uniform(rng);
+        add_deviation(accuracy,sum_relative_error,resonance(energy,y),cm2_to_m2*nusquids_cross_section(energy,y));
+    }
+    if(accuracy.n_samples != 0)
+        accuracy.mean_relative_error = sum_relative_error/accuracy.n_samples;
+    return accuracy;
 }
 
 } // namespace LW
@@ -0,0 +1,196 @@
+#include <LeptonWeighter/EffectiveTauCrossSectionTable.h>
+#include <nuSQuIDS/taudecay.h>
+#include <nuSQuIDS/AdaptiveQuad.h>
+#include <stdexcept>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <cmath>
+
+namespace LW {
+
+namespace {
+
+double integrate_effective_cross_section(const CrossSection& cs, nusquids::TauDecaySpectra& tds,
+        ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+        double energy, double x, double y){
+    double y_max = y;
+    double y_min = 0.0;
+    AdaptiveQuad::Options intOpt;
+    double int_precision = 1.e-8;
+    double eff_xs = AdaptiveQuad::integrate([&](double y_tau){
+                      double Etau = (1.-y_tau)*energy;
+                      double Emu = (1.-y)*energy;
+                      if(Emu >= Etau)
+                        return 0.0;
+                      if(y_tau==0.0)
+                        return 0.0;
+                      double dxs = cs.DoubleDifferentialCrossSection(primary, final_state_particle_0, final_state_particle_1,
+                                                                     energy, x, y_tau);
+                      double dndz = tds.TauDecayToLepton(Etau,Emu)*tds.GetTauToLeptonBranchingRatio();
+                      if(dxs*dndz <0) return 0.0;
+                      double dzdy = energy/Etau;
+                      return dxs*dndz*dzdy;
+                    },
+                    y_min, y_max, int_precision, &intOpt);
+    if(intOpt.outOfTolerance){
+        throw std::runtime_error("Integral when computing effective tau cross section did not achieve the requested accuracy.");
+    }
+    return eff_xs;
+}
+
+} // namespace
+
+EffectiveTauCrossSectionTable::EffectiveTauCrossSectionTable(std::shared_ptr<const CrossSection> cs,
+        double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+        double log10_x_min, double log10_x_max, unsigned int n_x,
+        double y_min, double y_max, unsigned int n_y,
+        double tolerance):
+    cs(cs),
+    log10_energy_min(log10_energy_min),log10_energy_max(log10_energy_max),
+    log10_x_min(log10_x_min),log10_x_max(log10_x_max),
+    y_min(y_min),y_max(y_max),
+    n_energy(n_energy),n_x(n_x),n_y(n_y)
+{
+    if(not cs)
+        throw std::runtime_error("EffectiveTauCrossSectionTable: null cross section.");
+    if(n_energy < 2 or n_x < 2 or n_y < 2)
+        throw std::runtime_error("EffectiveTauCrossSectionTable: every axis needs at least two nodes.");
+    if(not (log10_energy_max > log10_energy_min and log10_x_max > log10_x_min and y_max > y_min))
+        throw std::runtime_error("EffectiveTauCrossSectionTable: empty axis range.");
+    if(y_min < 0 or y_max > 1)
+        throw std::runtime_error("EffectiveTauCrossSectionTable: y range has to be inside [0,1].");
+
+    const ParticleType primaries[2] = {ParticleType::NuTau, ParticleType::NuTauBar};
+    const ParticleType leptons[2] = {ParticleType::TauMinus, ParticleType::TauPlus};
+    nusquids::TauDecaySpectra tds;
+    values.resize(2*static_cast<size_t>(n_energy)*n_x*n_y);
+    log_values.resize(values.size());
+    for(unsigned int nubar=0; nubar<2; nubar++){
+        for(unsigned int i=0; i<n_energy; i++){
+            double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*i/(n_energy-1));
+            for(unsigned int j=0; j<n_x; j++){
+                double x = pow(10.,log10_x_min+(log10_x_max-log10_x_min)*j/(n_x-1));
+                for(unsigned int k=0; k<n_y; k++){
+                    double y = y_min+(y_max-y_min)*k/(n_y-1);
+                    double value = integrate_effective_cross_section(*cs,tds,primaries[nubar],leptons[nubar],ParticleType::Hadrons,energy,x,y);
+                    values[node(nubar,i,j,k)] = value;
+                    log_values[node(nubar,i,j,k)] = value > 0 ? log(value) : std::numeric_limits<double>::quiet_NaN();
+                }
+            }
+        }
+    }
+
+    // check the interpolation where it is worst, in the middle of each cell
+    cell_trusted.assign(2*static_cast<size_t>(n_energy-1)*(n_x-1)*(n_y-1),true);
+    n_trusted_cells = cell_trusted.size();
+    if(tolerance <= 0)
+        return;
+    for(unsigned int nubar=0; nubar<2; nubar++){
+        for(unsigned int i=0; i+1<n_energy; i++){
+            double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*(i+0.5)/(n_energy-1));
+            for(unsigned int j=0; j+1<n_x; j++){
+                double x = pow(10.,log10_x_min+(log10_x_max-log10_x_min)*(j+0.5)/(n_x-1));
+                for(unsigned int k=0; k+1<n_y; k++){
+                    double y = y_min+(y_max-y_min)*(k+0.5)/(n_y-1);
+                    double exact = integrate_effective_cross_section(*cs,tds,primaries[nubar],leptons[nubar],ParticleType::Hadrons,energy,x,y);
+                    double tabulated = interpolate(nubar,i,j,k,0.5,0.5,0.5);
+                    if(not (std::abs(tabulated-exact) <= tolerance*std::abs(exact))){
+                        cell_trusted[cell(nubar,i,j,k)] = false;
+                        n_trusted_cells--;
+                    }
+                }
+            }
+        }
+    }
+}
+
+double EffectiveTauCrossSectionTable::interpolate(unsigned int nubar, unsigned int i, unsigned int j, unsigned int k, double fi, double fj, double fk) const {
+    double corner_log[8], corner[8];
+    bool use_log = true;
+    for(unsigned int c=0; c<8; c++){
+        size_t n = node(nubar,i+(c>>2),j+((c>>1)&1),k+(c&1));
+        corner[c] = values[n];
+        corner_log[c] = log_values[n];
+        use_log = use_log and not std::isnan(corner_log[c]);
+    }
+    const double* v = use_log ? corner_log : corner;
+    double c00 = v[0]*(1-fk)+v[1]*fk;
+    double c01 = v[2]*(1-fk)+v[3]*fk;
+    double c10 = v[4]*(1-fk)+v[5]*fk;
+    double c11 = v[6]*(1-fk)+v[7]*fk;
+    double c0 = c00*(1-fj)+c01*fj;
+    double c1 = c10*(1-fj)+c11*fj;
+    double result = c0*(1-fi)+c1*fi;
+    return use_log ? exp(result) : result;
+}
+
+bool EffectiveTauCrossSectionTable::tabulated_channel(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1, unsigned int& nubar){
+    if(final_state_particle_1 != ParticleType::Hadrons)
+        return false;
+    if(primary == ParticleType::NuTau and final_state_particle_0 == ParticleType::TauMinus){
+        nubar = 0;
+        return true;
+    }
+    if(primary == ParticleType::NuTauBar and final_state_particle_0 == ParticleType::TauPlus){
+        nubar = 1;
+        return true;
+    }
+    return false;
+}
+
+double EffectiveTauCrossSectionTable::integrate(const CrossSection& cs, ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+        double energy, double x, double y){
+    nusquids::TauDecaySpectra tds;
+    return integrate_effective_cross_section(cs,tds,primary,final_state_particle_0,final_state_particle_1,energy,x,y);
+}
+
+bool EffectiveTauCrossSectionTable::evaluate(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+        double energy, double x, double y, double& effective_cross_section) const {
+    unsigned int nubar;
+    if(not tabulated_channel(primary,final_state_particle_0,final_state_particle_1,nubar))
+        return false;
+    unsigned int i, j, k;
+    double fi, fj, fk;
+    if(not (grid::locate(log10(energy),log10_energy_min,log10_energy_max,n_energy,i,fi) and
+            grid::locate(log10(x),log10_x_min,log10_x_max,n_x,j,fj) and
+            grid::locate(y,y_min,y_max,n_y,k,fk)))
+        return false;
+    if(not cell_trusted[cell(nubar,i,j,k)])
+        return false;
+    effective_cross_section = interpolate(nubar,i,j,k,fi,fj,fk);
+    return true;
+}
+
+double EffectiveTauCrossSectionTable::operator()(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+        double energy, double x, double y) const {
+    double effective_cross_section;
+    if(evaluate(primary,final_state_particle_0,final_state_particle_1,energy,x,y,effective_cross_section))
+        return effective_cross_section;
+    return integrate(*cs,primary,final_state_particle_0,final_state_particle_1,energy,x,y);
+}
+
+TableAccuracy EffectiveTauCrossSectionTable::validate(unsigned int n_samples, unsigned int seed) const {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.,1.);
+    nusquids::TauDecaySpectra tds;
+    TableAccuracy accuracy;
+    for(unsigned int s=0; s<n_samples; s++){
+        bool nubar = s%2;
+        ParticleType primary = nubar ? ParticleType::NuTauBar : ParticleType::NuTau;
+        ParticleType lepton = nubar ? ParticleType::TauPlus : ParticleType::TauMinus;
+        double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*uniform(rng));
+        double x = pow(10.,log10_x_min+(log10_x_max-log10_x_min)*uniform(rng));
+        double y = y_min+(y_max-y_min)*uniform(rng);
+        double tabulated;
+        if(not evaluate(primary,lepton,ParticleType::Hadrons,energy,x,y,tabulated)){
+            accuracy.add_fallback();
+            continue;
+        }
+        double exact = integrate_effective_cross_section(*cs,tds,primary,lepton,ParticleType::Hadrons,energy,x,y);
+        accuracy.add(tabulated,exact);
+    }
+    return accuracy;
+}
+
+} // namespace LW
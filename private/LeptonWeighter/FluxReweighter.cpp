@@ -0,0 +1,93 @@
+#include <LeptonWeighter/FluxReweighter.h>
+#include <algorithm>
+
+namespace LW {
+
+FluxReweighter::FluxReweighter(const Weighter& w, std::vector<Event> events_):
+    events(std::move(events_)),
+    oneweight(w.get_oneweight(events)),
+    cs(w.get_cross_section()),
+    gv(w.get_generators())
+{}
+
+size_t FluxReweighter::find_stale_events(const Weighter& w, std::vector<bool>& stale) const {
+    stale.assign(events.size(),false);
+    if(w.get_cross_section() != cs){
+        stale.assign(events.size(),true);
+        return events.size();
+    }
+
+    // generators that were added or removed since the column was computed
+    const std::vector<std::shared_ptr<Generator>> new_gv = w.get_generators();
+    std::vector<std::shared_ptr<Generator>> changed;
+    for(const auto& g : new_gv){
+        if(std::find(gv.begin(),gv.end(),g) == gv.end())
+            changed.push_back(g);
+    }
+    for(const auto& g : gv){
+        if(std::find(new_gv.begin(),new_gv.end(),g) == new_gv.end())
+            changed.push_back(g);
+    }
+
+    size_t n_stale = 0;
+    for(const auto& g : changed){
+        for(size_t i=0; i<events.size(); i++){
+            if(not stale[i] and g->in_phase_space(events[i])){
+                stale[i] = true;
+                n_stale++;
+            }
+        }
+    }
+    return n_stale;
+}
+
+size_t FluxReweighter::stale_events(const Weighter& w) const {
+    std::vector<bool> stale;
+    return find_stale_events(w,stale);
+}
+
+size_t FluxReweighter::update(const Weighter& w) {
+    std::vector<bool> stale;
+    size_t n_stale = find_stale_events(w,stale);
+    if(n_stale != 0){
+        std::vector<Event> stale_sample;
+        stale_sample.reserve(n_stale);
+        for(size_t i=0; i<events.size(); i++){
+            if(stale[i])
+                stale_sample.push_back(events[i]);
+        }
+        std::vector<double> stale_oneweight = w.get_oneweight(stale_sample);
+        for(size_t i=0, j=0; i<events.size(); i++){
+            if(stale[i])
+                oneweight[i] = stale_oneweight[j++];
+        }
+    }
+    cs = w.get_cross_section();
+    gv = w.get_generators();
+    return n_stale;
+}
+
+void FluxReweighter::weight(const std::vector<std::shared_ptr<Flux>>& fluxes, double* out) const {
+    size_t n = events.size();
+    std::fill(out,out+n,0.);
+    std::vector<double> flux(n);
+    for(const auto& fp : fluxes){
+        fp->EvaluateFluxBatch(events.data(),n,flux.data());
+        for(size_t i=0; i<n; i++)
+            out[i] += flux[i];
+    }
+    for(size_t i=0; i<n; i++)
+        out[i] *= oneweight[i];
+}
+
+std::vector<double> FluxReweighter::weight(const std::vector<std::shared_ptr<Flux>>& fluxes) const {
+    std::vector<double> out(events.size());
+    weight(fluxes,out.data());
+    return out;
+}
+
+std::vector<double> FluxReweighter::weight(std::shared_ptr<Flux> flux) const {
+    return weight(std::vector<std::shared_ptr<Flux>>{flux});
+}
+
+} // namespace LW
@@ -1,8 +1,10 @@
 #include <LeptonWeighter/Generator.h>
 #include <LeptonWeighter/Constants.h>
+#include <LeptonWeighter/SplineRegistry.h>
 #include <stdexcept>
 #include <memory>
 #include <fstream>
+#include <map>
 #include <cmath>
 #include <hdf5.h>
 
@@ -10,7 +12,7 @@
 
 namespace LW {
 
-double Generator::probability(Event& e) const {
+double Generator::probability_kinematics(const Event& e) const {
     double p;
     p = probability_e(e.energy);
 #ifdef DEBUGPROBABILITY
@@ -35,14 +37,34 @@ double Generator::probability(Event& e) const {
 #ifdef DEBUGPROBABILITY
     std::cout << "ppos " << probability_pos(e.x,e.y,e.z, e.zenith, e.azimuth) << std::endl;
 #endif
+    return p;
+}
+
+double Generator::probability(const Event& e) const {
+    double p = probability_kinematics(e);
     if(p==0)
         return 0;
+    double targets = number_of_targets(e);
 #ifdef DEBUGPROBABILITY
     std::cout << "pfs " << probability_final_state(e.final_state_particle_0,e.final_state_particle_1) << std::endl;
-    std::cout << "pint " << probability_interaction(e.energy,e.interaction_x,e.interaction_y) << std::endl;
+    std::cout << "pint " << probability_interaction(e.energy,e.interaction_x,e.interaction_y,targets) << std::endl;
 #endif
     return p*probability_stat()*probability_final_state(e.final_state_particle_0,e.final_state_particle_1)*
-        probability_interaction(e.energy,e.interaction_y,number_of_targets(e))*probability_interaction(e.energy,e.interaction_x,e.interaction_y,number_of_targets(e));
+        probability_interaction(e.energy,e.interaction_y,targets)*probability_interaction(e.energy,e.interaction_x,e.interaction_y,targets);
+}
+
+double Generator::probability(const PreparedEvent& e) const {
+    double p = probability_kinematics(e);
+    if(p==0)
+        return 0;
+    double targets = number_of_targets(e);
+    return p*probability_stat()*probability_final_state(e.event.final_state_particle_0,e.event.final_state_particle_1)*
+        probability_interaction(e.event.energy,e.event.interaction_y,targets)*probability_interaction(e,targets);
+}
+
+bool Generator::in_phase_space(const Event& e) const {
+    return probability_e(e.energy) != 0 and probability_dir(e.zenith,e.azimuth) != 0 and
+        probability_final_state(e.final_state_particle_0,e.final_state_particle_1) != 0;
 }
 
 double Generator::probability_final_state(ParticleType final_state_particle_0_,ParticleType final_state_particle_1_) const{
@@ -104,25 +126,48 @@ double Generator::probability_interaction(double enu, double y,double number_of_
 }
 
 double Generator::probability_interaction(double enu, double x,double y,double number_of_targets) const {
+    return interaction_probability(*sim_details.Get_DifferentialSpline(),*sim_details.Get_TotalSpline(),enu,x,y,number_of_targets);
+}
+
+double Generator::probability_interaction(const PreparedEvent& e, double number_of_targets) const {
+    return probability_interaction(e.event.energy,e.event.interaction_x,e.event.interaction_y,number_of_targets);
+}
+
+double Generator::interaction_probability(const photospline::splinetable<>& differential_spline, const photospline::splinetable<>& total_spline,
+        double enu, double x, double y, double number_of_targets) {
+    double probability;
+    if(not try_interaction_probability(differential_spline,total_spline,enu,x,y,number_of_targets,probability))
+        throw std::runtime_error("Could not evaluate total neutrino cross section spline.");
+    return probability;
+}
+
+bool Generator::try_interaction_probability(const photospline::splinetable<>& differential_spline, const photospline::splinetable<>& total_spline,
+        double enu, double x, double y, double number_of_targets, double& probability) {
+    return try_log_interaction_probability(differential_spline,total_spline,log10(enu),log10(x),log10(y),number_of_targets,probability);
+}
+
+bool Generator::try_log_interaction_probability(const photospline::splinetable<>& differential_spline, const photospline::splinetable<>& total_spline,
+        double log10_enu, double log10_x, double log10_y, double number_of_targets, double& probability) {
     // DIS cross sections assumes all flavors to be equal in cross sections
     int centerbuffer[3];
     double xx[3];
 
-    xx[0] = log10(enu);
-    xx[1] = log10(x);
-    xx[2] = log10(y);
+    xx[0] = log10_enu;
+    xx[1] = log10_x;
+    xx[2] = log10_y;
 
-    double differential_xs, total_xs;
-    if(sim_details.Get_DifferentialSpline()->searchcenters(xx,centerbuffer))
-        differential_xs = pow(10.0,sim_details.Get_DifferentialSpline()->ndsplineeval(xx,centerbuffer,0));
+    double log10_differential_xs, log10_total_xs;
+    if(differential_spline.searchcenters(xx,centerbuffer))
+        log10_differential_xs = differential_spline.ndsplineeval(xx,centerbuffer,0);
     else
-        throw std::runtime_error("Could not evaluate total neutrino cross section spline.");
-    if(sim_details.Get_TotalSpline()->searchcenters(xx,centerbuffer))
-        total_xs = pow(10.0,sim_details.Get_TotalSpline()->ndsplineeval(xx,centerbuffer,0));
+        return false;
+    if(total_spline.searchcenters(xx,centerbuffer))
+        log10_total_xs = total_spline.ndsplineeval(xx,centerbuffer,0);
     else
-        throw std::runtime_error("Could not evaluate total neutrino cross section spline.");
+        return false;
 
-    return differential_xs/(1. - exp(-total_xs*number_of_targets));
+    probability = interaction_probability(log10_differential_xs,log10_total_xs,number_of_targets);
+    return true;
 }
 
 double RangeGenerator::probability_area() const {
@@ -155,12 +200,12 @@ RangeSimulationDetails RangeSimulationDetails::ReadFromFile(std::string configur
 }
 
 RangeSimulationDetails RangeSimulationDetails::MakeFromRangeInjectorConfiguration(RangedInjectionConfiguration ric) {
-    using splinetable_=photospline::splinetable<>;
-    std::shared_ptr<splinetable_> differentialCrossSectionData = std::make_shared<splinetable_>();
-    differentialCrossSectionData->read_fits_mem(ric.differentialCrossSectionData.data(),ric.differentialCrossSectionData.size());
-    std::shared_ptr<splinetable_> totalCrossSectionData = std::make_shared<splinetable_>();
-    totalCrossSectionData->read_fits_mem(ric.totalCrossSectionData.data(),ric.totalCrossSectionData.size());
+    SplineRegistry& registry = SplineRegistry::global();
+    return MakeFromRangeInjectorConfiguration(ric,registry.get(ric.differentialCrossSectionData),registry.get(ric.totalCrossSectionData));
+}
 
+RangeSimulationDetails RangeSimulationDetails::MakeFromRangeInjectorConfiguration(const RangedInjectionConfiguration& ric,
+        std::shared_ptr<const photospline::splinetable<>> differentialCrossSectionData, std::shared_ptr<const photospline::splinetable<>> totalCrossSectionData) {
     return RangeSimulationDetails(ric.injectionRadius,ric.injectionCap,
             ric.number_of_events,
             ric.final_state_particle_0,ric.final_state_particle_1,
@@ -195,12 +240,12 @@ VolumeSimulationDetails VolumeSimulationDetails::ReadFromFile(std::string config
 }
 
 VolumeSimulationDetails VolumeSimulationDetails::MakeFromVolumeInjectorConfiguration(VolumeInjectionConfiguration vic){
-    using splinetable_=photospline::splinetable<>;
-    std::shared_ptr<splinetable_> differentialCrossSectionData = std::make_shared<splinetable_>();
-    differentialCrossSectionData->read_fits_mem(vic.differentialCrossSectionData.data(),vic.differentialCrossSectionData.size());
-    std::shared_ptr<splinetable_> totalCrossSectionData = std::make_shared<splinetable_>();
-    totalCrossSectionData->read_fits_mem(vic.totalCrossSectionData.data(),vic.totalCrossSectionData.size());
+    SplineRegistry& registry = SplineRegistry::global();
+    return MakeFromVolumeInjectorConfiguration(vic,registry.get(vic.differentialCrossSectionData),registry.get(vic.totalCrossSectionData));
+}
 
+VolumeSimulationDetails VolumeSimulationDetails::MakeFromVolumeInjectorConfiguration(const VolumeInjectionConfiguration& vic,
+        std::shared_ptr<const photospline::splinetable<>> differentialCrossSectionData, std::shared_ptr<const photospline::splinetable<>> totalCrossSectionData){
     return VolumeSimulationDetails(vic.cylinderRadius,vic.cylinderHeight,
             vic.number_of_events,
             vic.final_state_particle_0,vic.final_state_particle_1,
@@ -315,11 +360,131 @@ double VolumeGenerator::probability_pos(double x, double y, double z, double zen
     return get_eff_height(x,y,z,zenith,azimuth)/(1e4*M_PI*vol_sim_details.Get_CylinderRadius()*vol_sim_details.Get_CylinderRadius()*vol_sim_details.Get_CylinderHeight());
 }
 
-double RangeGenerator::number_of_targets(Event& e) const {
+void PositionColumns::assign(const Event* events, size_t n){
+    for(auto column : {&x,&y,&z,&cos_zenith,&sin_zenith,&cos_azimuth,&sin_azimuth})
+        column->resize(n);
+    for(size_t i=0; i<n; i++){
+        const Event& e = events[i];
+        x[i] = e.x;
+        y[i] = e.y;
+        z[i] = e.z;
+        cos_zenith[i] = cos(e.zenith);
+        sin_zenith[i] = sin(e.zenith);
+        cos_azimuth[i] = cos(e.azimuth);
+        sin_azimuth[i] = sin(e.azimuth);
+    }
+}
+
+void PositionColumns::gather(const PositionColumns& other, const size_t* indices, size_t m){
+    std::vector<double> PositionColumns::* const columns[] = {&PositionColumns::x,&PositionColumns::y,&PositionColumns::z,
+        &PositionColumns::cos_zenith,&PositionColumns::sin_zenith,&PositionColumns::cos_azimuth,&PositionColumns::sin_azimuth};
+    for(auto column : columns){
+        std::vector<double>& to = this->*column;
+        const std::vector<double>& from = other.*column;
+        to.resize(m);
+        for(size_t k=0; k<m; k++)
+            to[k] = from[indices[k]];
+    }
+}
+
+void VolumeGenerator::get_eff_height_batch(const PositionColumns& columns, double* out) const {
+    // the expressions of get_eff_height, in the same order, with the branches turned into selections.
+    // The conditions are combined with & rather than the short circuiting and, which would branch.
+    const double r = vol_sim_details.Get_CylinderRadius();
+    const double height = vol_sim_details.Get_CylinderHeight();
+    const double cz1 = -1*height/2;
+    const double cz2 = -1*cz1;
+    const size_t n = columns.size();
+    const double* px = columns.x.data();
+    const double* py = columns.y.data();
+    const double* pz = columns.z.data();
+    const double* cos_zenith = columns.cos_zenith.data();
+    const double* sin_zenith = columns.sin_zenith.data();
+    const double* cos_azimuth = columns.cos_azimuth.data();
+    const double* sin_azimuth = columns.sin_azimuth.data();
+    for(size_t i=0; i<n; i++){
+        const double x = px[i], y = py[i], z = pz[i];
+        const double nx = cos_azimuth[i]*sin_zenith[i];
+        const double ny = sin_azimuth[i]*sin_zenith[i];
+        const double nz = cos_zenith[i];
+
+        const double nx2 = nx*nx;
+        const double ny2 = ny*ny;
+        const double nr2 = nx2 + ny2;
+        const double n_sum = -(nx*x + ny*y);
+        const double r0_2 = x*x+y*y;
+
+        const double root = sqrt(n_sum*n_sum - nr2*(r0_2-r*r));
+        const double sol_1 = (n_sum - root)/nr2;
+        const double sol_2 = (n_sum + root)/nr2;
+
+        // cylinder intersections
+        double x1 = x + nx*sol_1;
+        double y1 = y + ny*sol_1;
+        double z1 = z + nz*sol_1;
+        double x2 = x + nx*sol_2;
+        double y2 = y + ny*sol_2;
+        double z2 = z + nz*sol_2;
+
+        const bool b1_lower = z1<cz1;
+        const bool b2_lower = z2<cz1;
+        const bool b1_upper = z1>cz2;
+        const bool b2_upper = z2>cz2;
+
+        // endcap intersections
+        const double t1 = (cz1-z)/nz;
+        const double lower_x = x + nx*t1;
+        const double lower_y = y + ny*t1;
+        const double t2 = (cz2-z)/nz;
+        const double upper_x = x + nx*t2;
+        const double upper_y = y + ny*t2;
+
+        // the lower endcap replaces the first point if it is below, else the second
+        const bool lower_1 = b1_lower;
+        const bool lower_2 = b2_lower & !b1_lower;
+        x1 = lower_1 ? lower_x : x1;
+        y1 = lower_1 ? lower_y : y1;
+        z1 = lower_1 ? cz1 : z1;
+        x2 = lower_2 ? lower_x : x2;
+        y2 = lower_2 ? lower_y : y2;
+        z2 = lower_2 ? cz1 : z2;
+        // then the upper endcap the same way
+        const bool upper_1 = b1_upper;
+        const bool upper_2 = b2_upper & !b1_upper;
+        x1 = upper_1 ? upper_x : x1;
+        y1 = upper_1 ? upper_y : y1;
+        z1 = upper_1 ? cz2 : z1;
+        x2 = upper_2 ? upper_x : x2;
+        y2 = upper_2 ? upper_y : y2;
+        z2 = upper_2 ? cz2 : z2;
+
+        const double dx = x2-x1, dy = y2-y1, dz = z2-z1;
+        const double chord = sqrt(dx*dx + dy*dy + dz*dz);
+        // vertical directions cross the whole height
+        out[i] = ((nx==0.0) & (ny==0.0)) ? height : chord;
+    }
+}
+
+void VolumeGenerator::probability_pos_batch(const PositionColumns& columns, double* out) const {
+    get_eff_height_batch(columns,out);
+    const double radius = vol_sim_details.Get_CylinderRadius();
+    const double height = vol_sim_details.Get_CylinderHeight();
+    const double norm = 1e4*M_PI*radius*radius*height;
+    const size_t n = columns.size();
+    const double* x = columns.x.data();
+    const double* y = columns.y.data();
+    const double* z = columns.z.data();
+    for(size_t i=0; i<n; i++){
+        const bool inside = !(std::abs(z[i])>height/2) & !(sqrt(x[i]*x[i] + y[i]*y[i])>radius);
+        out[i] = inside ? out[i]/norm : 0.;
+    }
+}
+
+double RangeGenerator::number_of_targets(const Event& e) const {
     return Constants::Na*e.total_column_depth;
 }
 
-double VolumeGenerator::number_of_targets(Event& e) const {
+double VolumeGenerator::number_of_targets(const Event& e) const {
     return Constants::Na*e.total_column_depth;
 }
 
@@ -422,6 +587,7 @@ std::vector<std::shared_ptr<Generator>> MakeGeneratorsFromLICFile(std::string co
         throw std::runtime_error("LW::MakeGeneratorsFromLICFile: Configuration file error while reading.");
     EnumDefBlock edb;
     is >> edb;
+    SplineRegistry& registry = SplineRegistry::global();
 
     // Trust
     //if(not CheckParticleEnumeration(edb))
@@ -441,12 +607,14 @@ std::vector<std::shared_ptr<Generator>> MakeGeneratorsFromLICFile(std::string co
       if(h.block_name == "RangedInjectionConfiguration"){
         RangedInjectionConfiguration ric;
         is >> ric;
-        generator_vector.push_back(std::make_shared<RangeGenerator>(RangeSimulationDetails::MakeFromRangeInjectorConfiguration(ric)));
+        generator_vector.push_back(std::make_shared<RangeGenerator>(RangeSimulationDetails::MakeFromRangeInjectorConfiguration(ric,
+                        registry.get(ric.differentialCrossSectionData),registry.get(ric.totalCrossSectionData))));
 
       } else if (h.block_name == "VolumeInjectionConfiguration"){
         VolumeInjectionConfiguration vic;
         is >> vic;
-        generator_vector.push_back(std::make_shared<VolumeGenerator>(VolumeSimulationDetails::MakeFromVolumeInjectorConfiguration(vic)));
+        generator_vector.push_back(std::make_shared<VolumeGenerator>(VolumeSimulationDetails::MakeFromVolumeInjectorConfiguration(vic,
+                        registry.get(vic.differentialCrossSectionData),registry.get(vic.totalCrossSectionData))));
       } else {
         throw std::runtime_error("LW::MakeGeneratorsFromLICFile: Expected either VolumeSimulationDetails or RangedInjectionConfiguration block after enum definitions, but got " + h.block_name);
       }
@@ -1,12 +1,63 @@
 #include "LeptonWeighter/NNFluxInterface.h"
+#include <vector>
+#include <algorithm>
 
 namespace LW {
 
 double atmosNeutrinoFlux::EvaluateFlux(const Event& e) const{
+  if(table)
+    return table->EvaluateFlux(e);
   if(!nugen_compatible)
     return(flux->getFlux((I3Particle::ParticleType)e.primary_type, e.energy, cos(e.zenith)));
   else
     return 2.*(flux->getFlux((I3Particle::ParticleType)e.primary_type, e.energy, cos(e.zenith)));
 }
 
+double atmosNeutrinoFlux::EvaluateFlux(const PreparedEvent& e) const{
+  if(table)
+    return table->EvaluateFlux(e);
+  if(!nugen_compatible)
+    return(flux->getFlux((I3Particle::ParticleType)e.event.primary_type, e.event.energy, e.cos_zenith));
+  else
+    return 2.*(flux->getFlux((I3Particle::ParticleType)e.event.primary_type, e.event.energy, e.cos_zenith));
+}
+
+void atmosNeutrinoFlux::EvaluateFluxBatch(const Event* events, size_t n, double* out) const{
+  if(table){
+    table->EvaluateFluxBatch(events,n,out);
+    return;
+  }
+  // events of each primary type, in the order they come
+  std::vector<ParticleType> types;
+  std::vector<std::vector<size_t>> type_events;
+  size_t last = 0;
+  for(size_t i=0; i<n; i++){
+    if(types.empty() or types[last] != events[i].primary_type){
+      last = std::find(types.begin(),types.end(),events[i].primary_type)-types.begin();
+      if(last == types.size()){
+        types.push_back(events[i].primary_type);
+        type_events.emplace_back();
+      }
+    }
+    type_events[last].push_back(i);
+  }
+  for(size_t k=0; k<types.size(); k++){
+    const I3Particle::ParticleType type = (I3Particle::ParticleType)types[k];
+    for(size_t i : type_events[k])
+      out[i] = flux->getFlux(type, events[i].energy, cos(events[i].zenith));
+  }
+  if(nugen_compatible){
+    for(size_t i=0; i<n; i++)
+      out[i] = 2.*out[i];
+  }
+}
+
+std::shared_ptr<const TabulatedFlux> atmosNeutrinoFlux::enable_table(double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+    unsigned int n_cos_zenith, double tolerance){
+  // the table falls back to an adapter of the same flux without a table
+  std::shared_ptr<const Flux> source = std::make_shared<atmosNeutrinoFlux>(flux,nugen_compatible);
+  table = std::make_shared<const TabulatedFlux>(source,log10_energy_min,log10_energy_max,n_energy,-1.,1.,n_cos_zenith,tolerance);
+  return table;
+}
+
 } // close LW namespace
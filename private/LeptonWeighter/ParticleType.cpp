@@ -7,4 +7,9 @@ std::ostream& operator<<(std::ostream& os, ParticleType& pt) {
   return os;
 }
 
+bool is_charged_lepton(ParticleType p) {
+  using PT=ParticleType;
+  return p == PT::EPlus or p == PT::EMinus or p == PT::MuPlus or p == PT::MuMinus or p == PT::TauPlus or p == PT::TauMinus;
+}
+
 } // close LW namespace
@@ -0,0 +1,79 @@
+#include <LeptonWeighter/PhaseSpaceIndex.h>
+#include <algorithm>
+#include <iterator>
+#include <typeinfo>
+#include <cmath>
+
+namespace LW {
+
+uint64_t PhaseSpaceIndex::final_state_key(ParticleType final_state_particle_0, ParticleType final_state_particle_1) {
+    // generators accept the final state in either order
+    int32_t a = static_cast<int32_t>(final_state_particle_0);
+    int32_t b = static_cast<int32_t>(final_state_particle_1);
+    if(a > b)
+        std::swap(a,b);
+    return (static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32) | static_cast<uint32_t>(b);
+}
+
+PhaseSpaceIndex::PhaseSpaceIndex(const std::vector<std::shared_ptr<Generator>>& gv){
+    // indexed generators per final state
+    std::unordered_map<uint64_t,std::vector<size_t>> members;
+    for(size_t j=0; j<gv.size(); j++){
+        const Generator& g = *gv[j];
+        all.push_back(j);
+        if(typeid(g) == typeid(RangeGenerator) or typeid(g) == typeid(VolumeGenerator))
+            members[final_state_key(g.sim_details.Get_ParticleType0(),g.sim_details.Get_ParticleType1())].push_back(j);
+        else
+            always.push_back(j);
+    }
+
+    for(const auto& m : members){
+        Bucket& bucket = buckets[m.first];
+        for(size_t j : m.second){
+            bucket.bounds.push_back(gv[j]->sim_details.Get_MinEnergy());
+            bucket.bounds.push_back(gv[j]->sim_details.Get_MaxEnergy());
+        }
+        std::sort(bucket.bounds.begin(),bucket.bounds.end());
+        bucket.bounds.erase(std::unique(bucket.bounds.begin(),bucket.bounds.end()),bucket.bounds.end());
+
+        const size_t n_bounds = bucket.bounds.size();
+        bucket.candidates.assign(2*n_bounds+1,std::vector<size_t>());
+        for(size_t k=0; k<n_bounds; k++){
+            const double lower = bucket.bounds[k];
+            // the open range above the last bound is covered by no indexed generator
+            const bool has_upper = k+1 < n_bounds;
+            const double upper = has_upper ? bucket.bounds[k+1] : lower;
+            for(size_t j : m.second){
+                const double energyMin = gv[j]->sim_details.Get_MinEnergy();
+                const double energyMax = gv[j]->sim_details.Get_MaxEnergy();
+                if(energyMin <= lower and lower <= energyMax)
+                    bucket.candidates[2*k].push_back(j);
+                if(has_upper and energyMin <= lower and upper <= energyMax)
+                    bucket.candidates[2*k+1].push_back(j);
+            }
+        }
+        for(auto& c : bucket.candidates){
+            std::vector<size_t> merged;
+            std::merge(c.begin(),c.end(),always.begin(),always.end(),std::back_inserter(merged));
+            c.swap(merged);
+        }
+    }
+}
+
+const std::vector<size_t>& PhaseSpaceIndex::candidates(const Event& e) const {
+    if(std::isnan(e.energy))
+        return all;
+    auto it = buckets.find(final_state_key(e.final_state_particle_0,e.final_state_particle_1));
+    if(it == buckets.end())
+        return always;
+    const Bucket& bucket = it->second;
+    const size_t n_bounds = bucket.bounds.size();
+    size_t k = std::lower_bound(bucket.bounds.begin(),bucket.bounds.end(),e.energy)-bucket.bounds.begin();
+    if(k < n_bounds and bucket.bounds[k] == e.energy)
+        return bucket.candidates[2*k];
+    if(k == 0)
+        return bucket.candidates[2*n_bounds];
+    return bucket.candidates[2*(k-1)+1];
+}
+
+} // namespace LW
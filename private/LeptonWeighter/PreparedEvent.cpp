@@ -0,0 +1,20 @@
+#include <LeptonWeighter/PreparedEvent.h>
+#include <math.h>
+
+namespace LW {
+
+void PreparedEvent::prepare(){
+    log10_energy = log10(event.energy);
+    log10_interaction_x = log10(event.interaction_x);
+    log10_interaction_y = log10(event.interaction_y);
+
+    cos_zenith = cos(event.zenith);
+
+    using PT=ParticleType;
+    const ParticleType primary_type = event.primary_type;
+    neutrino = primary_type == PT::NuE or primary_type == PT::NuMu or primary_type == PT::NuTau;
+    antineutrino = primary_type == PT::NuEBar or primary_type == PT::NuMuBar or primary_type == PT::NuTauBar;
+    charged_current = is_charged_lepton(event.final_state_particle_0) or is_charged_lepton(event.final_state_particle_1);
+}
+
+} // namespace LW
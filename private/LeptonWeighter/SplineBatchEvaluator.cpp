@@ -0,0 +1,262 @@
+#include <LeptonWeighter/SplineBatchEvaluator.h>
+#include <photospline/bspline.h>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <limits>
+
+// the block kernels are compiled a second time for AVX2 and picked at run time
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+#define LW_SPLINE_AVX2_DISPATCH
+#endif
+
+namespace LW {
+
+namespace {
+
+// maps a double onto an integer scale on which neighbouring doubles differ by one
+int64_t ordered_bits(double x){
+    int64_t bits;
+    std::memcpy(&bits,&x,sizeof(bits));
+    return bits < 0 ? std::numeric_limits<int64_t>::min()-bits : bits;
+}
+
+#ifdef LW_SPLINE_AVX2_DISPATCH
+bool detect_avx2(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+const bool has_avx2 = detect_avx2();
+#endif
+
+} // namespace
+
+uint64_t ulp_distance(double a, double b){
+    int64_t ia = ordered_bits(a), ib = ordered_bits(b);
+    return ia > ib ? static_cast<uint64_t>(ia)-static_cast<uint64_t>(ib) : static_cast<uint64_t>(ib)-static_cast<uint64_t>(ia);
+}
+
+const unsigned int SplineBatchEvaluator::lanes;
+const unsigned int SplineBatchEvaluator::max_dimensions;
+const unsigned int SplineBatchEvaluator::max_order;
+const unsigned int SplineBatchEvaluator::single_lanes;
+
+SplineBatchEvaluator::SplineBatchEvaluator(const photospline::splinetable<>& spline):
+    spline(&spline),ndim(spline.get_ndim()),vectorized(ndim >= 1 and ndim <= max_dimensions),
+    coefficients(spline.get_coefficients()),coefficient_offset(0)
+{
+    for(unsigned int d=0; d<std::min(ndim,max_dimensions); d++){
+        order[d] = spline.get_order(d);
+        knots[d] = spline.get_knots(d);
+        n_knots[d] = spline.get_nknots(d);
+        strides[d] = spline.get_strides()[d];
+        vectorized = vectorized and order[d] <= max_order;
+    }
+    const uint64_t n_coefficients = spline.get_ncoeffs();
+    if(n_coefficients != 0){
+        auto range = std::minmax_element(coefficients,coefficients+n_coefficients);
+        coefficient_offset = 0.5f*(*range.first)+0.5f*(*range.second);
+    }
+}
+
+template<typename Real, unsigned int block_lanes>
+inline __attribute__((always_inline))
+void SplineBatchEvaluator::evaluate_block(const double* const* coordinates, size_t begin, size_t n, float offset, double* out, bool* in_range) const {
+    const unsigned int lanes = block_lanes;
+    double x[max_dimensions][lanes];
+    int centers[max_dimensions][lanes];
+    bool inside[lanes];
+
+    // knot search. Unused lanes and points outside the table are parked on the first knot
+    // interval, so that the lanes below run without branches.
+    for(unsigned int l=0; l<lanes; l++){
+        double point[max_dimensions];
+        int point_centers[max_dimensions];
+        inside[l] = l < n;
+        if(inside[l]){
+            for(unsigned int d=0; d<ndim; d++)
+                point[d] = coordinates[d][begin+l];
+            inside[l] = spline->searchcenters(point,point_centers);
+        }
+        for(unsigned int d=0; d<ndim; d++){
+            centers[d][l] = inside[l] ? point_centers[d] : static_cast<int>(order[d]);
+            x[d][l] = inside[l] ? point[d] : knots[d][order[d]];
+        }
+    }
+
+    // nonzero basis functions, de Boor's recursion as in photospline's bsplvb_simple. The basis
+    // functions are stored as floats; the knot distances, the quotient and the carried term are
+    // taken in Real, which is double as in bsplvb_simple unless running in single precision.
+    float basis[max_dimensions][max_order+1][lanes];
+    for(unsigned int d=0; d<ndim; d++){
+        const double* t = knots[d];
+        Real delta_left[max_order][lanes], delta_right[max_order][lanes];
+        for(unsigned int l=0; l<lanes; l++)
+            basis[d][0][l] = 1.f;
+        for(unsigned int j=0; j<order[d]; j++){
+            for(unsigned int l=0; l<lanes; l++){
+                delta_right[j][l] = static_cast<Real>(t[centers[d][l]+j+1]-x[d][l]);
+                delta_left[j][l] = static_cast<Real>(x[d][l]-t[centers[d][l]-static_cast<int>(j)]);
+            }
+            Real saved[lanes];
+            for(unsigned int l=0; l<lanes; l++)
+                saved[l] = 0.;
+            for(unsigned int i=0; i<=j; i++){
+                for(unsigned int l=0; l<lanes; l++){
+                    Real term = static_cast<Real>(basis[d][i][l])/(delta_right[i][l]+delta_left[j-i][l]);
+                    basis[d][i][l] = static_cast<float>(saved[l]+delta_right[i][l]*term);
+                    saved[l] = delta_left[j-i][l]*term;
+                }
+            }
+            for(unsigned int l=0; l<lanes; l++)
+                basis[d][j+1][l] = static_cast<float>(saved[l]);
+        }
+        // points below the first fully supported knot interval take bsplvb_simple itself, which
+        // moves the valid functions into place. searchcenters never returns the center on which
+        // bsplvb_simple does the same at the upper end.
+        for(unsigned int l=0; l<lanes; l++){
+            if(centers[d][l] == static_cast<int>(order[d]) and x[d][l] < t[order[d]]){
+                float edge[max_order+1];
+                photospline::bsplvb_simple(t,n_knots[d],x[d][l],centers[d][l],order[d]+1,edge);
+                for(unsigned int i=0; i<=order[d]; i++)
+                    basis[d][i][l] = edge[i];
+            }
+        }
+    }
+
+    // tensor product contraction as in photospline's ndsplineeval_core: the products of the
+    // basis functions are built up from the first dimension, each term is that product times
+    // the coefficient, in float, and the terms are summed into a float with the last dimension
+    // running fastest
+    uint64_t first_coefficient[lanes];
+    for(unsigned int l=0; l<lanes; l++){
+        first_coefficient[l] = 0;
+        for(unsigned int d=0; d<ndim; d++)
+            first_coefficient[l] += (centers[d][l]-order[d])*strides[d];
+    }
+    unsigned int k[max_dimensions] = {0};
+    // partial[d] is the product of the basis functions of dimensions 0 to d
+    float partial[max_dimensions][lanes];
+    float sum[lanes];
+    for(unsigned int l=0; l<lanes; l++){
+        sum[l] = 0.f;
+        partial[0][l] = basis[0][0][l];
+    }
+    for(unsigned int d=1; d<ndim; d++){
+        for(unsigned int l=0; l<lanes; l++)
+            partial[d][l] = partial[d-1][l]*basis[d][0][l];
+    }
+    uint64_t coefficient = 0;
+    while(true){
+        const float* weight = partial[ndim-1];
+        for(unsigned int l=0; l<lanes; l++)
+            sum[l] += weight[l]*(coefficients[first_coefficient[l]+coefficient] - offset);
+
+        int d = ndim-1;
+        while(d >= 0 and ++k[d] > order[d]){
+            coefficient -= order[d]*strides[d];
+            k[d] = 0;
+            d--;
+        }
+        if(d < 0)
+            break;
+        coefficient += strides[d];
+        for(unsigned int e=d; e<ndim; e++){
+            for(unsigned int l=0; l<lanes; l++)
+                partial[e][l] = (e == 0 ? 1.f : partial[e-1][l])*basis[e][k[e]][l];
+        }
+    }
+
+    for(unsigned int l=0; l<n; l++){
+        in_range[begin+l] = inside[l];
+        if(inside[l])
+            out[begin+l] = static_cast<double>(offset)+static_cast<double>(sum[l]);
+    }
+}
+
+template<typename Real, unsigned int block_lanes>
+void SplineBatchEvaluator::evaluate_blocks(const double* const* coordinates, size_t n, float offset, double* out, bool* in_range) const {
+    for(size_t begin=0; begin<n; begin+=block_lanes)
+        evaluate_block<Real,block_lanes>(coordinates,begin,std::min(static_cast<size_t>(block_lanes),n-begin),offset,out,in_range);
+}
+
+#ifdef LW_SPLINE_AVX2_DISPATCH
+// same instructions as the baseline build except for the vector width; no FMA, so that the
+// products and sums round exactly as in ndsplineeval
+template<typename Real, unsigned int block_lanes>
+__attribute__((target("avx2")))
+void SplineBatchEvaluator::evaluate_blocks_avx2(const double* const* coordinates, size_t n, float offset, double* out, bool* in_range) const {
+    for(size_t begin=0; begin<n; begin+=block_lanes)
+        evaluate_block<Real,block_lanes>(coordinates,begin,std::min(static_cast<size_t>(block_lanes),n-begin),offset,out,in_range);
+}
+#endif
+
+bool SplineBatchEvaluator::uses_avx2(){
+#ifdef LW_SPLINE_AVX2_DISPATCH
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+void SplineBatchEvaluator::evaluate(const double* const* coordinates, size_t n, double* out, bool* in_range) const {
+    if(not vectorized){
+        evaluate_pointwise(coordinates,n,out,in_range);
+        return;
+    }
+#ifdef LW_SPLINE_AVX2_DISPATCH
+    if(has_avx2){
+        evaluate_blocks_avx2<double,lanes>(coordinates,n,0.f,out,in_range);
+        return;
+    }
+#endif
+    evaluate_blocks<double,lanes>(coordinates,n,0.f,out,in_range);
+}
+
+void SplineBatchEvaluator::evaluate_single(const double* const* coordinates, size_t n, double* out, bool* in_range) const {
+    if(not vectorized){
+        evaluate_pointwise(coordinates,n,out,in_range);
+        return;
+    }
+#ifdef LW_SPLINE_AVX2_DISPATCH
+    if(has_avx2){
+        evaluate_blocks_avx2<float,single_lanes>(coordinates,n,coefficient_offset,out,in_range);
+        return;
+    }
+#endif
+    evaluate_blocks<float,single_lanes>(coordinates,n,coefficient_offset,out,in_range);
+}
+
+void SplineBatchEvaluator::evaluate_pointwise(const double* const* coordinates, size_t n, double* out, bool* in_range) const {
+    std::vector<double> point(ndim);
+    std::vector<int> centers(ndim);
+    for(size_t i=0; i<n; i++){
+        for(unsigned int d=0; d<ndim; d++)
+            point[d] = coordinates[d][i];
+        in_range[i] = spline->searchcenters(point.data(),centers.data());
+        if(in_range[i])
+            out[i] = spline->ndsplineeval(point.data(),centers.data(),0);
+    }
+}
+
+uint64_t SplineBatchEvaluator::max_ulp_difference(const double* const* coordinates, size_t n) const {
+    std::vector<double> values(n);
+    std::unique_ptr<bool[]> in_range(new bool[n]);
+    evaluate(coordinates,n,values.data(),in_range.get());
+    std::vector<double> point(ndim);
+    std::vector<int> centers(ndim);
+    uint64_t max_difference = 0;
+    for(size_t i=0; i<n; i++){
+        if(not in_range[i])
+            continue;
+        for(unsigned int d=0; d<ndim; d++)
+            point[d] = coordinates[d][i];
+        spline->searchcenters(point.data(),centers.data());
+        max_difference = std::max(max_difference,ulp_distance(values[i],spline->ndsplineeval(point.data(),centers.data(),0)));
+    }
+    return max_difference;
+}
+
+} // namespace LW
@@ -0,0 +1,86 @@
+#include <LeptonWeighter/SplineRegistry.h>
+#include <fstream>
+#include <iterator>
+
+namespace LW {
+
+SplineRegistry& SplineRegistry::global(){
+    static SplineRegistry registry;
+    return registry;
+}
+
+SplineRegistry::Key SplineRegistry::content_key(const char* data, size_t size){
+    // FNV-1a and an independent multiplicative hash, in one pass
+    uint64_t fnv = 14695981039346656037ull;
+    uint64_t mix = 0x9e3779b97f4a7c15ull;
+    for(size_t i=0; i<size; i++){
+        const uint64_t byte = static_cast<unsigned char>(data[i]);
+        fnv = (fnv^byte)*1099511628211ull;
+        mix = (mix^(byte+i))*0xbf58476d1ce4e5b9ull;
+        mix ^= mix >> 29;
+    }
+    return Key(size,fnv,mix);
+}
+
+std::shared_ptr<const SplineRegistry::splinetable> SplineRegistry::find(const Key& key) const {
+    auto it = splines.find(key);
+    return it != splines.end() ? it->second.lock() : nullptr;
+}
+
+std::shared_ptr<const SplineRegistry::splinetable> SplineRegistry::get(const char* data, size_t size){
+    const Key key = content_key(data,size);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(std::shared_ptr<const splinetable> spline = find(key)){
+            hits++;
+            return spline;
+        }
+        misses++;
+    }
+    // parse without holding the lock, so that other tables can be looked up and read meanwhile
+    std::shared_ptr<splinetable> spline = std::make_shared<splinetable>();
+    // photospline only reads from the buffer
+    spline->read_fits_mem(const_cast<char*>(data),size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // another thread may have read the same data in the meantime; everyone gets the first spline
+    if(std::shared_ptr<const splinetable> winner = find(key))
+        return winner;
+    // forget the splines nobody holds anymore before adding a new one
+    for(auto e = splines.begin(); e != splines.end();){
+        if(e->second.expired())
+            e = splines.erase(e);
+        else
+            ++e;
+    }
+    splines[key] = spline;
+    return spline;
+}
+
+std::shared_ptr<const SplineRegistry::splinetable> SplineRegistry::get_file(const std::string& path){
+    std::ifstream is(path,std::ios::binary);
+    if(not is.good())
+        return nullptr;
+    std::vector<char> fits_data((std::istreambuf_iterator<char>(is)),std::istreambuf_iterator<char>());
+    if(is.bad())
+        return nullptr;
+    return get(fits_data);
+}
+
+SplineRegistryStatistics SplineRegistry::get_statistics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    SplineRegistryStatistics statistics;
+    statistics.hits = hits;
+    statistics.misses = misses;
+    for(const auto& e : splines)
+        statistics.resident += not e.second.expired();
+    return statistics;
+}
+
+void SplineRegistry::reset_statistics(){
+    std::lock_guard<std::mutex> lock(mutex);
+    hits = 0;
+    misses = 0;
+}
+
+} // namespace LW
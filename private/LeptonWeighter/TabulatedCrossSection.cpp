@@ -0,0 +1,256 @@
+#include <LeptonWeighter/TabulatedCrossSection.h>
+#include <stdexcept>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <cmath>
+
+namespace LW {
+
+namespace {
+
+// nodes and weights along one axis. Linear uses the two nodes of the cell, cubic the
+// Catmull-Rom stencil of four, clamped at the ends of the axis.
+unsigned int stencil(TabulatedCrossSection::Interpolation interpolation, unsigned int cell, unsigned int n, double f,
+        unsigned int nodes[4], double weights[4]){
+    if(interpolation == TabulatedCrossSection::Interpolation::Linear){
+        grid::linear_stencil(cell,f,nodes,weights);
+        return 2;
+    }
+    grid::catmull_rom_stencil(cell,n,f,nodes,weights);
+    return 4;
+}
+
+// a primary and final state representing each channel when sampling
+const ParticleType channel_primary[4] = {ParticleType::NuMu, ParticleType::NuMuBar, ParticleType::NuMu, ParticleType::NuMuBar};
+const ParticleType channel_final_state[4] = {ParticleType::MuMinus, ParticleType::MuPlus, ParticleType::NuMu, ParticleType::NuMuBar};
+
+// every neutrino type and final state, DIS and Glashow resonance, that find_channel maps onto each
+// channel; the table only holds where they all agree with the representative above
+struct ChannelMember {
+    ParticleType primary, final_state_particle_0, final_state_particle_1;
+};
+const ChannelMember nu_CC_members[] = {
+    {ParticleType::NuE,ParticleType::EMinus,ParticleType::Hadrons},
+    {ParticleType::NuTau,ParticleType::TauMinus,ParticleType::Hadrons}};
+const ChannelMember nubar_CC_members[] = {
+    {ParticleType::NuEBar,ParticleType::EPlus,ParticleType::Hadrons},
+    {ParticleType::NuTauBar,ParticleType::TauPlus,ParticleType::Hadrons},
+    {ParticleType::NuEBar,ParticleType::EMinus,ParticleType::NuEBar},
+    {ParticleType::NuEBar,ParticleType::MuMinus,ParticleType::NuMuBar},
+    {ParticleType::NuEBar,ParticleType::TauMinus,ParticleType::NuTauBar}};
+const ChannelMember nu_NC_members[] = {
+    {ParticleType::NuE,ParticleType::NuE,ParticleType::Hadrons},
+    {ParticleType::NuTau,ParticleType::NuTau,ParticleType::Hadrons}};
+const ChannelMember nubar_NC_members[] = {
+    {ParticleType::NuEBar,ParticleType::NuEBar,ParticleType::Hadrons},
+    {ParticleType::NuTauBar,ParticleType::NuTauBar,ParticleType::Hadrons},
+    {ParticleType::NuEBar,ParticleType::Hadrons,ParticleType::Hadrons}};
+const ChannelMember* const channel_members[4] = {nu_CC_members, nubar_CC_members, nu_NC_members, nubar_NC_members};
+const unsigned int n_channel_members[4] = {2, 5, 2, 3};
+
+// whether the other members of the channel have the cross section reference, within the tolerance
+bool same_across_channel(const CrossSection& cs, unsigned int channel, double energy, double x, double y, double reference, double tolerance){
+    for(unsigned int m=0; m<n_channel_members[channel]; m++){
+        const ChannelMember& member = channel_members[channel][m];
+        double value = cs.DoubleDifferentialCrossSection(member.primary,member.final_state_particle_0,member.final_state_particle_1,energy,x,y);
+        if(not (std::abs(value-reference) <= std::max(tolerance,0.)*std::abs(reference)))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+TabulatedCrossSection::TabulatedCrossSection(std::shared_ptr<const CrossSection> cs,
+        double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+        double log10_x_min, double log10_x_max, unsigned int n_x,
+        double log10_y_min, double log10_y_max, unsigned int n_y,
+        Interpolation interpolation, double tolerance):
+    cs(cs),
+    log10_energy_min(log10_energy_min),log10_energy_max(log10_energy_max),
+    log10_x_min(log10_x_min),log10_x_max(log10_x_max),
+    log10_y_min(log10_y_min),log10_y_max(log10_y_max),
+    n_energy(n_energy),n_x(n_x),n_y(n_y),
+    interpolation(interpolation)
+{
+    if(not cs)
+        throw std::runtime_error("TabulatedCrossSection: null cross section.");
+    if(n_energy < 2 or n_x < 2 or n_y < 2)
+        throw std::runtime_error("TabulatedCrossSection: every axis needs at least two nodes.");
+    if(not (log10_energy_max > log10_energy_min and log10_x_max > log10_x_min and log10_y_max > log10_y_min))
+        throw std::runtime_error("TabulatedCrossSection: empty axis range.");
+    if(log10_x_max > 0 or log10_y_max > 0)
+        throw std::runtime_error("TabulatedCrossSection: x and y ranges have to be inside (0,1].");
+
+    log_values.resize(4*static_cast<size_t>(n_energy)*n_x*n_y);
+    // nodes where the channel members disagree
+    std::vector<char> node_flavor_dependent(log_values.size(),false);
+    for(unsigned int channel=0; channel<4; channel++){
+        for(unsigned int i=0; i<n_energy; i++){
+            double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*i/(n_energy-1));
+            for(unsigned int j=0; j<n_x; j++){
+                double x = pow(10.,log10_x_min+(log10_x_max-log10_x_min)*j/(n_x-1));
+                for(unsigned int k=0; k<n_y; k++){
+                    double y = pow(10.,log10_y_min+(log10_y_max-log10_y_min)*k/(n_y-1));
+                    double value = cs->DoubleDifferentialCrossSection(channel_primary[channel],channel_final_state[channel],ParticleType::Hadrons,energy,x,y);
+                    log_values[node(channel,i,j,k)] = value > 0 ? log(value) : std::numeric_limits<double>::quiet_NaN();
+                    node_flavor_dependent[node(channel,i,j,k)] = not same_across_channel(*cs,channel,energy,x,y,value,tolerance);
+                }
+            }
+        }
+    }
+
+    // check the interpolation in the middle of each cell. A non-positive node in the
+    // stencil makes the interpolation NaN, which fails the check as well. So do cells where
+    // the members of the channel disagree at a corner or in the middle.
+    cell_trusted.assign(4*static_cast<size_t>(n_energy-1)*(n_x-1)*(n_y-1),true);
+    n_trusted_cells = cell_trusted.size();
+    n_flavor_dependent_cells = 0;
+    for(unsigned int channel=0; channel<4; channel++){
+        for(unsigned int i=0; i+1<n_energy; i++){
+            double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*(i+0.5)/(n_energy-1));
+            for(unsigned int j=0; j+1<n_x; j++){
+                double x = pow(10.,log10_x_min+(log10_x_max-log10_x_min)*(j+0.5)/(n_x-1));
+                for(unsigned int k=0; k+1<n_y; k++){
+                    double y = pow(10.,log10_y_min+(log10_y_max-log10_y_min)*(k+0.5)/(n_y-1));
+                    double tabulated = interpolate(channel,i,j,k,0.5,0.5,0.5);
+                    bool trusted = std::isfinite(tabulated);
+                    double exact = cs->DoubleDifferentialCrossSection(channel_primary[channel],channel_final_state[channel],ParticleType::Hadrons,energy,x,y);
+                    if(trusted and tolerance > 0)
+                        trusted = std::abs(tabulated-exact) <= tolerance*std::abs(exact);
+                    bool flavor_dependent = not same_across_channel(*cs,channel,energy,x,y,exact,tolerance);
+                    for(unsigned int corner=0; corner<8; corner++)
+                        flavor_dependent = flavor_dependent or node_flavor_dependent[node(channel,i+(corner&1),j+((corner>>1)&1),k+(corner>>2))];
+                    if(flavor_dependent){
+                        n_flavor_dependent_cells++;
+                        trusted = false;
+                    }
+                    if(not trusted){
+                        cell_trusted[cell(channel,i,j,k)] = false;
+                        n_trusted_cells--;
+                    }
+                }
+            }
+        }
+    }
+}
+
+double TabulatedCrossSection::interpolate(unsigned int channel, unsigned int i, unsigned int j, unsigned int k, double fi, double fj, double fk) const {
+    unsigned int nodes_i[4], nodes_j[4], nodes_k[4];
+    double weights_i[4], weights_j[4], weights_k[4];
+    const unsigned int s = stencil(interpolation,i,n_energy,fi,nodes_i,weights_i);
+    stencil(interpolation,j,n_x,fj,nodes_j,weights_j);
+    stencil(interpolation,k,n_y,fk,nodes_k,weights_k);
+    double result = 0;
+    for(unsigned int a=0; a<s; a++){
+        double plane = 0;
+        for(unsigned int b=0; b<s; b++){
+            const double* row = &log_values[node(channel,nodes_i[a],nodes_j[b],0)];
+            double line = 0;
+            for(unsigned int c=0; c<s; c++)
+                line += weights_k[c]*row[nodes_k[c]];
+            plane += weights_j[b]*line;
+        }
+        result += weights_i[a]*plane;
+    }
+    return exp(result);
+}
+
+bool TabulatedCrossSection::find_channel(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1, unsigned int& channel){
+    if(primary == ParticleType::NuE or primary == ParticleType::NuMu or primary == ParticleType::NuTau)
+        channel = 0;
+    else if(primary == ParticleType::NuEBar or primary == ParticleType::NuMuBar or primary == ParticleType::NuTauBar)
+        channel = 1;
+    else
+        return false;
+    if(not (is_charged_lepton(final_state_particle_0) or is_charged_lepton(final_state_particle_1)))
+        channel += 2;
+    return true;
+}
+
+bool TabulatedCrossSection::evaluate(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+        double energy, double x, double y, double& cross_section) const {
+    unsigned int channel;
+    if(not find_channel(primary,final_state_particle_0,final_state_particle_1,channel))
+        return false;
+    return evaluate_log(channel,log10(energy),log10(x),log10(y),cross_section);
+}
+
+bool TabulatedCrossSection::evaluate_log(unsigned int channel, double log10_energy, double log10_x, double log10_y, double& cross_section) const {
+    unsigned int i, j, k;
+    double fi, fj, fk;
+    if(not (grid::locate(log10_energy,log10_energy_min,log10_energy_max,n_energy,i,fi) and
+            grid::locate(log10_x,log10_x_min,log10_x_max,n_x,j,fj) and
+            grid::locate(log10_y,log10_y_min,log10_y_max,n_y,k,fk)))
+        return false;
+    if(not cell_trusted[cell(channel,i,j,k)])
+        return false;
+    cross_section = interpolate(channel,i,j,k,fi,fj,fk);
+    return true;
+}
+
+double TabulatedCrossSection::DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const {
+    double cross_section;
+    if(evaluate(pt,finalstate_0,finalstate_1,energy,x,y,cross_section))
+        return cross_section;
+    return cs->DoubleDifferentialCrossSection(pt,finalstate_0,finalstate_1,energy,x,y);
+}
+
+double TabulatedCrossSection::DoubleDifferentialCrossSection(const PreparedEvent& e) const {
+    double cross_section;
+    if(e.neutrino or e.antineutrino){
+        const unsigned int channel = (e.neutrino ? 0 : 1)+(e.charged_current ? 0 : 2);
+        if(evaluate_log(channel,e.log10_energy,e.log10_interaction_x,e.log10_interaction_y,cross_section))
+            return cross_section;
+    }
+    return cs->DoubleDifferentialCrossSection(e);
+}
+
+void TabulatedCrossSection::DoubleDifferentialCrossSectionBatch(const Event* events, size_t n, double* out) const {
+    std::vector<size_t> missed;
+    for(size_t i=0; i<n; i++){
+        const Event& e = events[i];
+        if(not evaluate(e.primary_type,e.final_state_particle_0,e.final_state_particle_1,e.energy,e.interaction_x,e.interaction_y,out[i]))
+            missed.push_back(i);
+    }
+    if(missed.empty())
+        return;
+    std::vector<Event> missed_events;
+    missed_events.reserve(missed.size());
+    for(size_t i : missed)
+        missed_events.push_back(events[i]);
+    std::vector<double> values(missed.size());
+    cs->DoubleDifferentialCrossSectionBatch(missed_events.data(),missed_events.size(),values.data());
+    for(size_t k=0; k<missed.size(); k++)
+        out[missed[k]] = values[k];
+}
+
+TableAccuracy TabulatedCrossSection::validate(unsigned int n_samples, unsigned int seed) const {
+    const ParticleType primaries[6] = {ParticleType::NuE, ParticleType::NuMu, ParticleType::NuTau,
+        ParticleType::NuEBar, ParticleType::NuMuBar, ParticleType::NuTauBar};
+    const ParticleType leptons[6] = {ParticleType::EMinus, ParticleType::MuMinus, ParticleType::TauMinus,
+        ParticleType::EPlus, ParticleType::MuPlus, ParticleType::TauPlus};
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.,1.);
+    TableAccuracy accuracy;
+    for(unsigned int s=0; s<n_samples; s++){
+        const unsigned int flavor = s%6;
+        const bool charged_current = (s/6)%2 == 0;
+        const ParticleType primary = primaries[flavor];
+        const ParticleType final_state = charged_current ? leptons[flavor] : primary;
+        double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*uniform(rng));
+        double x = pow(10.,log10_x_min+(log10_x_max-log10_x_min)*uniform(rng));
+        double y = pow(10.,log10_y_min+(log10_y_max-log10_y_min)*uniform(rng));
+        double tabulated;
+        if(not evaluate(primary,final_state,ParticleType::Hadrons,energy,x,y,tabulated)){
+            accuracy.add_fallback();
+            continue;
+        }
+        double exact = cs->DoubleDifferentialCrossSection(primary,final_state,ParticleType::Hadrons,energy,x,y);
+        accuracy.add(tabulated,exact);
+    }
+    return accuracy;
+}
+
+} // namespace LW
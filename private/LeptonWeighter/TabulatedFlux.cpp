@@ -0,0 +1,394 @@
+#include <LeptonWeighter/TabulatedFlux.h>
+#include <stdexcept>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <atomic>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace LW {
+
+const unsigned int TabulatedFlux::n_flavors;
+const uint32_t TabulatedFlux::file_format_version;
+
+namespace {
+
+const ParticleType flavors[TabulatedFlux::n_flavors] = {ParticleType::NuE, ParticleType::NuMu, ParticleType::NuTau,
+    ParticleType::NuEBar, ParticleType::NuMuBar, ParticleType::NuTauBar};
+
+// event the wrapped flux is sampled with
+Event sample_event(ParticleType primary, double energy, double cos_zenith){
+    Event e = Event();
+    e.primary_type = primary;
+    e.final_state_particle_0 = ParticleType::unknown;
+    e.final_state_particle_1 = ParticleType::unknown;
+    e.energy = energy;
+    e.zenith = acos(cos_zenith);
+    return e;
+}
+
+struct Tables {
+    std::vector<double> log_values;
+    std::vector<char> cell_trusted;
+};
+
+// layout of the file header, without padding
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t n_flavors;
+    uint32_t n_energy;
+    uint32_t n_cos_zenith;
+    uint32_t reserved;
+    double log10_energy_min, log10_energy_max;
+    double cos_zenith_min, cos_zenith_max;
+    uint64_t n_trusted_cells;
+    uint64_t values_offset, trusted_offset, file_size;
+    // FNV-1a of the nodes, the cells and the header with this last field zeroed
+    uint64_t values_checksum, trusted_checksum, header_checksum;
+};
+static_assert(sizeof(FileHeader) == 120, "TabulatedFlux file header must not be padded");
+
+const char file_magic[8] = {'L','W','F','L','U','X','T','\0'};
+const uint32_t byte_order_mark = 0x01020304;
+const uint64_t values_offset = 128;
+
+uint64_t fnv1a(const void* data, size_t size){
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i=0; i<size; i++)
+        hash = (hash^bytes[i])*1099511628211ull;
+    return hash;
+}
+
+uint64_t header_checksum(FileHeader header){
+    header.header_checksum = 0;
+    return fnv1a(&header,sizeof(header));
+}
+
+// writes size bytes to descriptor, continuing after partial writes and interruptions
+bool write_all(int descriptor, const void* data, size_t size){
+    const char* bytes = static_cast<const char*>(data);
+    while(size != 0){
+        ssize_t n = ::write(descriptor,bytes,size);
+        if(n < 0 and errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// creates a new file next to path, under a name no other writer in this or another process uses,
+// and returns its descriptor, or -1. The file gets the permissions of a file opened with mode 0666,
+// which the process umask restricts as for any other new file.
+int create_temporary(const std::string& path, std::string& temporary_path){
+    static std::atomic<unsigned long> counter(0);
+    for(unsigned int attempt=0; attempt<100; attempt++){
+        temporary_path = path+"."+std::to_string(getpid())+"."+std::to_string(counter++);
+        const int descriptor = open(temporary_path.c_str(),O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC,0666);
+        if(descriptor >= 0 or errno != EEXIST)
+            return descriptor;
+    }
+    return -1;
+}
+
+// unmaps the file when the last table using it goes away
+struct MappedFile {
+    void* address;
+    size_t size;
+    MappedFile(void* address, size_t size): address(address),size(size) {}
+    ~MappedFile(){ munmap(address,size); }
+};
+
+} // namespace
+
+bool TabulatedFlux::flavor_index(ParticleType primary, unsigned int& flavor){
+    const ParticleType* found = std::find(flavors,flavors+n_flavors,primary);
+    if(found == flavors+n_flavors)
+        return false;
+    flavor = found-flavors;
+    return true;
+}
+
+TabulatedFlux::TabulatedFlux(std::shared_ptr<const Flux> flux,
+        double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+        double cos_zenith_min, double cos_zenith_max, unsigned int n_cos_zenith,
+        double tolerance):
+    flux(flux),
+    log10_energy_min(log10_energy_min),log10_energy_max(log10_energy_max),
+    cos_zenith_min(cos_zenith_min),cos_zenith_max(cos_zenith_max),
+    n_energy(n_energy),n_cos_zenith(n_cos_zenith)
+{
+    if(not flux)
+        throw std::runtime_error("TabulatedFlux: null flux.");
+    if(n_energy < 2 or n_cos_zenith < 2)
+        throw std::runtime_error("TabulatedFlux: every axis needs at least two nodes.");
+    if(not (log10_energy_max > log10_energy_min and cos_zenith_max > cos_zenith_min))
+        throw std::runtime_error("TabulatedFlux: empty axis range.");
+    if(cos_zenith_min < -1 or cos_zenith_max > 1)
+        throw std::runtime_error("TabulatedFlux: cos(zenith) range has to be inside [-1,1].");
+
+    std::shared_ptr<Tables> tables = std::make_shared<Tables>();
+    tables->log_values.resize(n_flavors*static_cast<size_t>(n_energy)*n_cos_zenith);
+    for(unsigned int flavor=0; flavor<n_flavors; flavor++){
+        for(unsigned int i=0; i<n_energy; i++){
+            double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*i/(n_energy-1));
+            for(unsigned int j=0; j<n_cos_zenith; j++){
+                double cos_zenith = cos_zenith_min+(cos_zenith_max-cos_zenith_min)*j/(n_cos_zenith-1);
+                double value = flux->EvaluateFlux(sample_event(flavors[flavor],energy,cos_zenith));
+                tables->log_values[node(flavor,i,j)] = value > 0 ? log(value) : std::numeric_limits<double>::quiet_NaN();
+            }
+        }
+    }
+    log_values = tables->log_values.data();
+
+    // check the interpolation in the middle of each cell. A non-positive node in the
+    // stencil makes the interpolation NaN, which fails the check as well.
+    tables->cell_trusted.assign(number_of_cells(),true);
+    n_trusted_cells = number_of_cells();
+    for(unsigned int flavor=0; flavor<n_flavors; flavor++){
+        for(unsigned int i=0; i+1<n_energy; i++){
+            double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*(i+0.5)/(n_energy-1));
+            for(unsigned int j=0; j+1<n_cos_zenith; j++){
+                double cos_zenith = cos_zenith_min+(cos_zenith_max-cos_zenith_min)*(j+0.5)/(n_cos_zenith-1);
+                double tabulated = interpolate(flavor,i,j,0.5,0.5);
+                bool trusted = std::isfinite(tabulated);
+                if(trusted and tolerance > 0){
+                    double exact = flux->EvaluateFlux(sample_event(flavors[flavor],energy,cos_zenith));
+                    trusted = std::abs(tabulated-exact) <= tolerance*std::abs(exact);
+                }
+                if(not trusted){
+                    tables->cell_trusted[cell(flavor,i,j)] = false;
+                    n_trusted_cells--;
+                }
+            }
+        }
+    }
+    cell_trusted = tables->cell_trusted.data();
+    storage = tables;
+}
+
+double TabulatedFlux::interpolate(unsigned int flavor, unsigned int i, unsigned int j, double fi, double fj) const {
+    unsigned int nodes_i[4], nodes_j[4];
+    double weights_i[4], weights_j[4];
+    grid::catmull_rom_stencil(i,n_energy,fi,nodes_i,weights_i);
+    grid::catmull_rom_stencil(j,n_cos_zenith,fj,nodes_j,weights_j);
+    double result = 0;
+    for(unsigned int a=0; a<4; a++){
+        const double* row = log_values+node(flavor,nodes_i[a],0);
+        double line = 0;
+        for(unsigned int b=0; b<4; b++)
+            line += weights_j[b]*row[nodes_j[b]];
+        result += weights_i[a]*line;
+    }
+    return exp(result);
+}
+
+bool TabulatedFlux::locate_point(double log10_energy, double cos_zenith, unsigned int& i, unsigned int& j, double& fi, double& fj) const {
+    return grid::locate(log10_energy,log10_energy_min,log10_energy_max,n_energy,i,fi) and
+        grid::locate(cos_zenith,cos_zenith_min,cos_zenith_max,n_cos_zenith,j,fj);
+}
+
+bool TabulatedFlux::evaluate_log(unsigned int flavor, double log10_energy, double cos_zenith, double& flux) const {
+    unsigned int i, j;
+    double fi, fj;
+    if(not locate_point(log10_energy,cos_zenith,i,j,fi,fj))
+        return false;
+    if(not cell_trusted[cell(flavor,i,j)])
+        return false;
+    flux = interpolate(flavor,i,j,fi,fj);
+    return true;
+}
+
+bool TabulatedFlux::evaluate(ParticleType primary, double energy, double cos_zenith, double& flux) const {
+    unsigned int flavor;
+    if(not flavor_index(primary,flavor))
+        return false;
+    return evaluate_log(flavor,log10(energy),cos_zenith,flux);
+}
+
+double TabulatedFlux::untabulated_flux(const Event& e) const {
+    if(flux)
+        return flux->EvaluateFlux(e);
+    unsigned int flavor, i, j;
+    double fi, fj;
+    if(not (flavor_index(e.primary_type,flavor) and locate_point(log10(e.energy),cos(e.zenith),i,j,fi,fj)))
+        throw std::runtime_error("TabulatedFlux: event outside the table and no flux to fall back to.");
+    double value = interpolate(flavor,i,j,fi,fj);
+    return std::isnan(value) ? 0. : value;
+}
+
+TabulatedFlux::result_type TabulatedFlux::EvaluateFlux(const Event& e) const {
+    double value;
+    if(evaluate(e.primary_type,e.energy,cos(e.zenith),value))
+        return value;
+    return untabulated_flux(e);
+}
+
+TabulatedFlux::result_type TabulatedFlux::EvaluateFlux(const PreparedEvent& e) const {
+    double value;
+    unsigned int flavor;
+    if(flavor_index(e.event.primary_type,flavor) and evaluate_log(flavor,e.log10_energy,e.cos_zenith,value))
+        return value;
+    if(not flux)
+        return untabulated_flux(e);
+    return flux->EvaluateFlux(e);
+}
+
+void TabulatedFlux::EvaluateFluxBatch(const Event* events, size_t n, double* out) const {
+    std::vector<size_t> missed;
+    for(size_t i=0; i<n; i++){
+        const Event& e = events[i];
+        if(not evaluate(e.primary_type,e.energy,cos(e.zenith),out[i]))
+            missed.push_back(i);
+    }
+    if(missed.empty())
+        return;
+    if(not flux){
+        for(size_t i : missed)
+            out[i] = untabulated_flux(events[i]);
+        return;
+    }
+    std::vector<Event> missed_events;
+    missed_events.reserve(missed.size());
+    for(size_t i : missed)
+        missed_events.push_back(events[i]);
+    std::vector<double> values(missed.size());
+    flux->EvaluateFluxBatch(missed_events.data(),missed_events.size(),values.data());
+    for(size_t k=0; k<missed.size(); k++)
+        out[missed[k]] = values[k];
+}
+
+void TabulatedFlux::write(const std::string& path) const {
+    const size_t n_nodes = n_flavors*static_cast<size_t>(n_energy)*n_cos_zenith;
+    FileHeader header;
+    std::memset(&header,0,sizeof(header));
+    std::memcpy(header.magic,file_magic,sizeof(file_magic));
+    header.version = file_format_version;
+    header.byte_order = byte_order_mark;
+    header.n_flavors = n_flavors;
+    header.n_energy = n_energy;
+    header.n_cos_zenith = n_cos_zenith;
+    header.log10_energy_min = log10_energy_min;
+    header.log10_energy_max = log10_energy_max;
+    header.cos_zenith_min = cos_zenith_min;
+    header.cos_zenith_max = cos_zenith_max;
+    header.n_trusted_cells = n_trusted_cells;
+    header.values_offset = values_offset;
+    header.trusted_offset = values_offset+n_nodes*sizeof(double);
+    header.file_size = header.trusted_offset+number_of_cells();
+    header.values_checksum = fnv1a(log_values,n_nodes*sizeof(double));
+    header.trusted_checksum = fnv1a(cell_trusted,number_of_cells());
+    header.header_checksum = header_checksum(header);
+
+    // a unique name next to the destination, so that concurrent writers of the same path do not
+    // share a temporary file and the rename stays on one file system
+    std::string temporary_path;
+    const int descriptor = create_temporary(path,temporary_path);
+    if(descriptor < 0)
+        throw std::runtime_error("TabulatedFlux: cannot create a temporary file for "+path+".");
+    const char padding[values_offset-sizeof(FileHeader)] = {};
+    bool written = write_all(descriptor,&header,sizeof(header)) and
+        write_all(descriptor,padding,sizeof(padding)) and
+        write_all(descriptor,log_values,n_nodes*sizeof(double)) and
+        write_all(descriptor,cell_trusted,number_of_cells()) and
+        fsync(descriptor) == 0;
+    written = close(descriptor) == 0 and written;
+    if(not written){
+        unlink(temporary_path.c_str());
+        throw std::runtime_error("TabulatedFlux: cannot write the table to "+temporary_path+".");
+    }
+    if(std::rename(temporary_path.c_str(),path.c_str()) != 0){
+        unlink(temporary_path.c_str());
+        throw std::runtime_error("TabulatedFlux: cannot move the table to "+path+".");
+    }
+}
+
+std::shared_ptr<TabulatedFlux> TabulatedFlux::Open(const std::string& path, std::shared_ptr<const Flux> flux, bool verify_checksums){
+    const int descriptor = open(path.c_str(),O_RDONLY);
+    if(descriptor < 0)
+        throw std::runtime_error("TabulatedFlux: cannot open "+path+".");
+    struct stat status;
+    if(fstat(descriptor,&status) != 0 or static_cast<size_t>(status.st_size) < sizeof(FileHeader)){
+        close(descriptor);
+        throw std::runtime_error("TabulatedFlux: "+path+" is not a flux table.");
+    }
+    const size_t size = status.st_size;
+    void* address = mmap(nullptr,size,PROT_READ,MAP_SHARED,descriptor,0);
+    close(descriptor);
+    if(address == MAP_FAILED)
+        throw std::runtime_error("TabulatedFlux: cannot map "+path+".");
+    std::shared_ptr<const MappedFile> mapping = std::make_shared<const MappedFile>(address,size);
+    const char* bytes = static_cast<const char*>(address);
+
+    FileHeader header;
+    std::memcpy(&header,bytes,sizeof(header));
+    if(std::memcmp(header.magic,file_magic,sizeof(file_magic)) != 0)
+        throw std::runtime_error("TabulatedFlux: "+path+" is not a flux table.");
+    if(header.byte_order != byte_order_mark)
+        throw std::runtime_error("TabulatedFlux: "+path+" was written on a machine with a different byte order.");
+    if(header.version != file_format_version)
+        throw std::runtime_error("TabulatedFlux: "+path+" has format version "+std::to_string(header.version)+
+                ", this build reads version "+std::to_string(file_format_version)+".");
+    if(header.header_checksum != header_checksum(header))
+        throw std::runtime_error("TabulatedFlux: corrupted header in "+path+".");
+    if(header.n_flavors != n_flavors or header.n_energy < 2 or header.n_cos_zenith < 2)
+        throw std::runtime_error("TabulatedFlux: unexpected grid in "+path+".");
+
+    std::shared_ptr<TabulatedFlux> table(new TabulatedFlux());
+    table->flux = flux;
+    table->log10_energy_min = header.log10_energy_min;
+    table->log10_energy_max = header.log10_energy_max;
+    table->cos_zenith_min = header.cos_zenith_min;
+    table->cos_zenith_max = header.cos_zenith_max;
+    table->n_energy = header.n_energy;
+    table->n_cos_zenith = header.n_cos_zenith;
+    table->n_trusted_cells = header.n_trusted_cells;
+    const size_t n_nodes = n_flavors*static_cast<size_t>(header.n_energy)*header.n_cos_zenith;
+    if(header.values_offset != values_offset or header.trusted_offset != values_offset+n_nodes*sizeof(double) or
+            header.file_size != header.trusted_offset+table->number_of_cells() or header.file_size != size)
+        throw std::runtime_error("TabulatedFlux: "+path+" is truncated or has an unexpected layout.");
+    table->log_values = reinterpret_cast<const double*>(bytes+header.values_offset);
+    table->cell_trusted = bytes+header.trusted_offset;
+    if(verify_checksums and (fnv1a(table->log_values,n_nodes*sizeof(double)) != header.values_checksum or
+            fnv1a(table->cell_trusted,table->number_of_cells()) != header.trusted_checksum))
+        throw std::runtime_error("TabulatedFlux: corrupted table in "+path+".");
+    table->storage = mapping;
+    return table;
+}
+
+TableAccuracy TabulatedFlux::validate(unsigned int n_samples, unsigned int seed) const {
+    if(not flux)
+        throw std::runtime_error("TabulatedFlux: no flux to validate the table against.");
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.,1.);
+    TableAccuracy accuracy;
+    for(unsigned int s=0; s<n_samples; s++){
+        const ParticleType primary = flavors[s%n_flavors];
+        double energy = pow(10.,log10_energy_min+(log10_energy_max-log10_energy_min)*uniform(rng));
+        double cos_zenith = cos_zenith_min+(cos_zenith_max-cos_zenith_min)*uniform(rng);
+        double tabulated;
+        if(not evaluate(primary,energy,cos_zenith,tabulated)){
+            accuracy.add_fallback();
+            continue;
+        }
+        double exact = flux->EvaluateFlux(sample_event(primary,energy,cos_zenith));
+        accuracy.add(tabulated,exact);
+    }
+    return accuracy;
+}
+
+} // namespace LW
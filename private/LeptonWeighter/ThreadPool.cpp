@@ -0,0 +1,119 @@
+#include <LeptonWeighter/ThreadPool.h>
+#include <algorithm>
+
+namespace LW {
+
+ThreadPool::ThreadPool(unsigned int n_threads):failed(false) {
+    if(n_threads == 0)
+        n_threads = std::max(1u,std::thread::hardware_concurrency());
+    for(unsigned int i=0; i<n_threads; i++)
+        queues.emplace_back(new WorkQueue);
+    // participant 0 is whoever calls parallel_for
+    for(unsigned int i=1; i<n_threads; i++)
+        workers.emplace_back(&ThreadPool::worker_loop,this,i);
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        stop = true;
+    }
+    job_cv.notify_all();
+    for(auto& w : workers)
+        w.join();
+}
+
+bool ThreadPool::next_task(unsigned int id, size_t& task){
+    // own work is taken from the front, so that neighbouring tasks run in order
+    {
+        WorkQueue& q = *queues[id];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if(not q.tasks.empty()){
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    // steal from the back of somebody else's queue
+    for(unsigned int k=1; k<queues.size(); k++){
+        WorkQueue& q = *queues[(id+k)%queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if(not q.tasks.empty()){
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_tasks(unsigned int id){
+    size_t task;
+    while(not failed.load(std::memory_order_relaxed) and next_task(id,task)){
+        try {
+            (*job)(task);
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if(not error)
+                error = std::current_exception();
+            failed = true;
+        }
+    }
+}
+
+void ThreadPool::worker_loop(unsigned int id){
+    unsigned long seen_generation = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(job_mutex);
+            job_cv.wait(lock,[&]{ return stop or job_generation != seen_generation; });
+            if(stop)
+                return;
+            seen_generation = job_generation;
+        }
+        run_tasks(id);
+        {
+            std::lock_guard<std::mutex> lock(job_mutex);
+            finished_workers++;
+        }
+        done_cv.notify_one();
+    }
+}
+
+void ThreadPool::parallel_for(size_t n_tasks, const std::function<void(size_t)>& task){
+    if(n_tasks == 0)
+        return;
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+
+    // deal out contiguous runs of tasks, one run per participant
+    size_t n_queues = queues.size();
+    for(size_t q=0; q<n_queues; q++){
+        size_t begin = n_tasks*q/n_queues;
+        size_t end = n_tasks*(q+1)/n_queues;
+        std::lock_guard<std::mutex> lock(queues[q]->mutex);
+        queues[q]->tasks.clear();
+        for(size_t i=begin; i<end; i++)
+            queues[q]->tasks.push_back(i);
+    }
+    error = nullptr;
+    failed = false;
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        job = &task;
+        finished_workers = 0;
+        job_generation++;
+    }
+    job_cv.notify_all();
+
+    run_tasks(0);
+
+    {
+        std::unique_lock<std::mutex> lock(job_mutex);
+        done_cv.wait(lock,[&]{ return finished_workers == workers.size(); });
+        job = nullptr;
+    }
+    if(error)
+        std::rethrow_exception(error);
+}
+
+} // namespace LW
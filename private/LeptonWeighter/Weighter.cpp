@@ -1,22 +1,85 @@
 #include <LeptonWeighter/Weighter.h>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 //#define DEBUGWEIGHTER
 
 namespace LW {
 
-double Weighter::get_total_flux(Event& e) const{
+const size_t Weighter::batch_block_size;
+
+namespace {
+
+// batch weights through the column functions of a plan, NaN outside the generation phase space
+void plan_weight(const WeightingPlan& plan, const Event* events, size_t n, double* out){
+    std::vector<double> generation_weight(n), cross_section(n);
+    plan.generation_probability(events,n,generation_weight.data());
+    plan.total_flux(events,n,out);
+    plan.cross_section(events,n,cross_section.data());
+    for(size_t i=0; i<n; i++)
+        out[i] = generation_weight[i] != 0 ? out[i]*cross_section[i]/generation_weight[i] : std::numeric_limits<double>::quiet_NaN();
+}
+
+} // namespace
+
+void Weighter::compile(){
+    plan = std::make_shared<const WeightingPlan>(fv,cs,gv);
+    status_plan.reset();
+}
+
+SinglePrecisionAccuracy Weighter::enable_single_precision(const Event* events, size_t n, double tolerance){
+    std::shared_ptr<const WeightingPlan> reference = std::make_shared<const WeightingPlan>(fv,cs,gv);
+    std::shared_ptr<const WeightingPlan> single = std::make_shared<const WeightingPlan>(fv,cs,gv,SplinePrecision::Single);
+    std::vector<double> reference_weights(n), single_weights(n);
+    plan_weight(*reference,events,n,reference_weights.data());
+    plan_weight(*single,events,n,single_weights.data());
+
+    SinglePrecisionAccuracy accuracy;
+    double sum_relative_error = 0;
+    for(size_t i=0; i<n; i++){
+        if(std::isnan(reference_weights[i]) or reference_weights[i] == 0)
+            continue;
+        double relative_error = std::abs(single_weights[i]-reference_weights[i])/std::abs(reference_weights[i]);
+        // a NaN deviation is never within tolerance
+        if(std::isnan(relative_error))
+            relative_error = std::numeric_limits<double>::infinity();
+        accuracy.max_relative_error = std::max(accuracy.max_relative_error,relative_error);
+        sum_relative_error += relative_error;
+        accuracy.n_samples++;
+    }
+    if(accuracy.n_samples != 0)
+        accuracy.mean_relative_error = sum_relative_error/accuracy.n_samples;
+    accuracy.accepted = accuracy.n_samples != 0 and accuracy.max_relative_error <= tolerance;
+    if(accuracy.accepted)
+        plan = single;
+    return accuracy;
+}
+
+template<typename EventType>
+double Weighter::total_flux_of(const EventType& e) const{
+    if(plan)
+        return plan->total_flux(e);
     double flux=0;
-    for(auto f : fv)
+    for(const auto& f : fv)
         flux += (*f)(e);
     return flux;
 }
 
-double Weighter::weight(Event& e) const{
+template<typename EventType>
+double Weighter::weight_of(const EventType& e) const{
+    if(plan){
+        double generation_weight = plan->generation_probability(e);
+        double flux = plan->total_flux(e);
+        if(generation_weight == 0)
+            throw std::runtime_error("Out of declared generation phase space. Impossible event.");
+        return flux*plan->cross_section(e)/generation_weight;
+    }
     double generation_weight = 0;
-    for(auto g : gv)
+    for(const auto& g : gv)
         generation_weight += (*g)(e);
     double flux=0;
-    for(auto f : fv)
+    for(const auto& f : fv)
         flux += (*f)(e);
 #ifdef DEBUGWEIGHTER
     std::cout << flux << " " << (*cs)(e) << " " << generation_weight << std::endl;
@@ -26,16 +89,352 @@ double Weighter::weight(Event& e) const{
     return flux*(*cs)(e)/generation_weight;
 }
 
-double Weighter::get_oneweight(Event& e) const{
+template<typename EventType>
+double Weighter::oneweight_of(const EventType& e) const{
+    if(plan){
+        double generation_weight = plan->generation_probability(e);
+        if(generation_weight == 0)
+            throw std::runtime_error("Out of declared generation phase space. Impossible event.");
+        return plan->cross_section(e)/generation_weight;
+    }
     double generation_weight = 0;
-    for(auto g : gv)
+    for(const auto& g : gv)
         generation_weight += (*g)(e);
     if(generation_weight == 0)
         throw std::runtime_error("Out of declared generation phase space. Impossible event.");
     return (*cs)(e)/generation_weight;
 }
 
-double Weighter::get_effective_tau_oneweight(Event & e) const{
+double Weighter::get_total_flux(const Event& e) const{
+    return total_flux_of(e);
+}
+
+double Weighter::get_total_flux(const PreparedEvent& e) const{
+    return total_flux_of(e);
+}
+
+double Weighter::weight(const Event& e) const{
+    return weight_of(e);
+}
+
+double Weighter::weight(const PreparedEvent& e) const{
+    return weight_of(e);
+}
+
+double Weighter::get_oneweight(const Event& e) const{
+    return oneweight_of(e);
+}
+
+double Weighter::get_oneweight(const PreparedEvent& e) const{
+    return oneweight_of(e);
+}
+
+void Weighter::get_generation_weight(const Event* events, size_t n, double* out) const{
+    if(plan)
+        plan->generation_probability(events,n,out);
+    else {
+        std::fill(out,out+n,0.);
+        for(const auto& gp : gv){
+            const Generator& g = *gp;
+            for(size_t i=0; i<n; i++)
+                out[i] += g(events[i]);
+        }
+    }
+    for(size_t i=0; i<n; i++){
+        if(out[i] == 0)
+            throw std::runtime_error("Out of declared generation phase space. Impossible event.");
+    }
+}
+
+void Weighter::get_cross_section(const Event* events, size_t n, double* out) const{
+    if(plan){
+        plan->cross_section(events,n,out);
+        return;
+    }
+    cs->DoubleDifferentialCrossSectionBatch(events,n,out);
+}
+
+void Weighter::get_total_flux(const Event* events, size_t n, double* out) const{
+    if(plan){
+        plan->total_flux(events,n,out);
+        return;
+    }
+    // one batch call per flux and block, added up in flux order as the single event function does
+    std::fill(out,out+n,0.);
+    double flux[batch_block_size];
+    for(size_t begin=0; begin<n; begin+=batch_block_size){
+        size_t block = std::min(batch_block_size,n-begin);
+        for(const auto& fp : fv){
+            fp->EvaluateFluxBatch(events+begin,block,flux);
+            for(size_t i=0; i<block; i++)
+                out[begin+i] += flux[i];
+        }
+    }
+}
+
+void Weighter::weight(const Event* events, size_t n, double* out) const{
+    double generation_weight[batch_block_size];
+    double cross_section[batch_block_size];
+    for(size_t begin=0; begin<n; begin+=batch_block_size){
+        size_t block = std::min(batch_block_size,n-begin);
+        const Event* block_events = events+begin;
+        double* block_out = out+begin;
+        get_generation_weight(block_events,block,generation_weight);
+        get_total_flux(block_events,block,block_out);
+        get_cross_section(block_events,block,cross_section);
+        for(size_t i=0; i<block; i++)
+            block_out[i] = block_out[i]*cross_section[i]/generation_weight[i];
+    }
+}
+
+void Weighter::get_oneweight(const Event* events, size_t n, double* out) const{
+    double cross_section[batch_block_size];
+    for(size_t begin=0; begin<n; begin+=batch_block_size){
+        size_t block = std::min(batch_block_size,n-begin);
+        const Event* block_events = events+begin;
+        double* block_out = out+begin;
+        get_generation_weight(block_events,block,block_out);
+        get_cross_section(block_events,block,cross_section);
+        for(size_t i=0; i<block; i++)
+            block_out[i] = cross_section[i]/block_out[i];
+    }
+}
+
+std::vector<double> Weighter::get_total_flux(const std::vector<Event>& events) const{
+    std::vector<double> out(events.size());
+    get_total_flux(events.data(),events.size(),out.data());
+    return out;
+}
+
+std::vector<double> Weighter::weight(const std::vector<Event>& events) const{
+    std::vector<double> out(events.size());
+    weight(events.data(),events.size(),out.data());
+    return out;
+}
+
+std::vector<double> Weighter::get_oneweight(const std::vector<Event>& events) const{
+    std::vector<double> out(events.size());
+    get_oneweight(events.data(),events.size(),out.data());
+    return out;
+}
+
+std::shared_ptr<const WeightingPlan> Weighter::get_status_plan() const{
+    if(plan)
+        return plan;
+    // the plan has the non-throwing evaluation, so an uncompiled weighter builds one once. Two
+    // threads may both build it; either result is equivalent and the last one stored is kept.
+    std::shared_ptr<const WeightingPlan> p = std::atomic_load(&status_plan);
+    if(not p){
+        p = std::make_shared<const WeightingPlan>(fv,cs,gv);
+        std::atomic_store(&status_plan,p);
+    }
+    return p;
+}
+
+WeightStatusCounts Weighter::weight_with_status(const Event* events, size_t n, double* out, WeightStatus* status, bool with_flux) const{
+    std::shared_ptr<const WeightingPlan> p = get_status_plan();
+    WeightStatusCounts counts;
+    for(size_t i=0; i<n; i++){
+        const Event& e = events[i];
+        double generation_weight, flux, cross_section;
+        WeightStatus s = p->try_generation_probability(e,generation_weight);
+        if(s == WeightStatus::OK and with_flux)
+            s = p->try_total_flux(e,flux);
+        if(s == WeightStatus::OK)
+            s = p->try_cross_section(e,cross_section);
+        if(s != WeightStatus::OK)
+            out[i] = std::numeric_limits<double>::quiet_NaN();
+        else if(with_flux)
+            out[i] = flux*cross_section/generation_weight;
+        else
+            out[i] = cross_section/generation_weight;
+        status[i] = s;
+        counts.add(s);
+    }
+    return counts;
+}
+
+WeightStatusCounts Weighter::weight(const Event* events, size_t n, double* out, WeightStatus* status) const{
+    return weight_with_status(events,n,out,status,true);
+}
+
+WeightStatusCounts Weighter::get_oneweight(const Event* events, size_t n, double* out, WeightStatus* status) const{
+    return weight_with_status(events,n,out,status,false);
+}
+
+WeightStatusCounts Weighter::weight(const std::vector<Event>& events, std::vector<double>& out, std::vector<WeightStatus>& status) const{
+    out.resize(events.size());
+    status.resize(events.size());
+    return weight_with_status(events.data(),events.size(),out.data(),status.data(),true);
+}
+
+WeightStatusCounts Weighter::get_oneweight(const std::vector<Event>& events, std::vector<double>& out, std::vector<WeightStatus>& status) const{
+    out.resize(events.size());
+    status.resize(events.size());
+    return weight_with_status(events.data(),events.size(),out.data(),status.data(),false);
+}
+
+void Weighter::get_weight_components(const Event* events, size_t n, WeightComponents& components, bool per_generator) const{
+    components.total_flux.resize(n);
+    components.cross_section.resize(n);
+    components.generation_probability.assign(n,0.);
+    components.generator_probability.clear();
+    if(per_generator)
+        components.generator_probability.assign(gv.size(),std::vector<double>(n));
+
+    double* generation_probability = components.generation_probability.data();
+    if(plan and not per_generator)
+        plan->generation_probability(events,n,generation_probability);
+    else {
+        for(size_t j=0; j<gv.size(); j++){
+            const Generator& g = *gv[j];
+            if(per_generator){
+                double* column = components.generator_probability[j].data();
+                if(plan)
+                    plan->generator_probability(j,events,n,column);
+                else {
+                    for(size_t i=0; i<n; i++)
+                        column[i] = g(events[i]);
+                }
+                for(size_t i=0; i<n; i++)
+                    generation_probability[i] += column[i];
+            } else {
+                for(size_t i=0; i<n; i++)
+                    generation_probability[i] += g(events[i]);
+            }
+        }
+    }
+    get_total_flux(events,n,components.total_flux.data());
+    get_cross_section(events,n,components.cross_section.data());
+}
+
+WeightComponents Weighter::get_weight_components(const std::vector<Event>& events, bool per_generator) const{
+    WeightComponents components;
+    get_weight_components(events.data(),events.size(),components,per_generator);
+    return components;
+}
+
+std::vector<double> WeightMatrix::weight(const std::vector<double>& normalizations) const{
+    if(normalizations.size() != components.size())
+        throw std::runtime_error("WeightMatrix::weight: expected one normalization per flux component.");
+    size_t n = size();
+    std::vector<double> out(n,0.);
+    for(size_t k=0; k<components.size(); k++){
+        const double norm = normalizations[k];
+        const double* flux = component_flux[k].data();
+        for(size_t i=0; i<n; i++)
+            out[i] += norm*flux[i];
+    }
+    for(size_t i=0; i<n; i++)
+        out[i] = out[i]*cross_section[i]/generation_probability[i];
+    return out;
+}
+
+WeightMatrix Weighter::weight_matrix(const Event* events, size_t n, const std::vector<std::vector<std::shared_ptr<Flux>>>& hypotheses) const{
+    WeightMatrix matrix;
+    // collect distinct fluxes
+    for(const auto& hypothesis : hypotheses){
+        std::vector<size_t> indices;
+        for(const auto& f : hypothesis){
+            size_t k = std::find(matrix.components.begin(),matrix.components.end(),f)-matrix.components.begin();
+            if(k == matrix.components.size())
+                matrix.components.push_back(f);
+            indices.push_back(k);
+        }
+        matrix.hypothesis_components.push_back(indices);
+    }
+
+    // flux independent terms
+    matrix.generation_probability.resize(n);
+    get_generation_weight(events,n,matrix.generation_probability.data());
+    matrix.cross_section.resize(n);
+    get_cross_section(events,n,matrix.cross_section.data());
+
+    // each distinct flux once
+    matrix.component_flux.assign(matrix.components.size(),std::vector<double>(n));
+    for(size_t k=0; k<matrix.components.size(); k++){
+        matrix.components[k]->EvaluateFluxBatch(events,n,matrix.component_flux[k].data());
+    }
+
+    // combine as Weighter::weight does
+    matrix.weights.assign(hypotheses.size(),std::vector<double>(n,0.));
+    for(size_t h=0; h<hypotheses.size(); h++){
+        double* column = matrix.weights[h].data();
+        for(size_t k : matrix.hypothesis_components[h]){
+            const double* flux = matrix.component_flux[k].data();
+            for(size_t i=0; i<n; i++)
+                column[i] += flux[i];
+        }
+        for(size_t i=0; i<n; i++)
+            column[i] = column[i]*matrix.cross_section[i]/matrix.generation_probability[i];
+    }
+    return matrix;
+}
+
+WeightMatrix Weighter::weight_matrix(const std::vector<Event>& events, const std::vector<std::vector<std::shared_ptr<Flux>>>& hypotheses) const{
+    return weight_matrix(events.data(),events.size(),hypotheses);
+}
+
+unsigned int Weighter::get_number_of_flux_parameters() const{
+    unsigned int n_parameters = 0;
+    for(const auto& f : fv)
+        n_parameters += f->GetNumberOfParameters();
+    return n_parameters;
+}
+
+void Weighter::weight_gradient(const Event* events, size_t n, double* weights, double* gradient) const{
+    const size_t n_parameters = get_number_of_flux_parameters();
+    double generation_weight[batch_block_size];
+    double cross_section[batch_block_size];
+    for(size_t begin=0; begin<n; begin+=batch_block_size){
+        size_t block = std::min(batch_block_size,n-begin);
+        const Event* block_events = events+begin;
+        double* block_weights = weights+begin;
+        double* block_gradient = gradient+begin*n_parameters;
+        get_generation_weight(block_events,block,generation_weight);
+        get_cross_section(block_events,block,cross_section);
+
+        std::fill(block_weights,block_weights+block,0.);
+        size_t offset = 0;
+        for(const auto& fp : fv){
+            const Flux& f = *fp;
+            for(size_t i=0; i<block; i++)
+                block_weights[i] += f.EvaluateFluxGradient(block_events[i],block_gradient+i*n_parameters+offset);
+            offset += f.GetNumberOfParameters();
+        }
+
+        for(size_t i=0; i<block; i++){
+            const double xs_value = cross_section[i];
+            block_weights[i] = block_weights[i]*xs_value/generation_weight[i];
+            double* row = block_gradient+i*n_parameters;
+            for(size_t j=0; j<n_parameters; j++)
+                row[j] = row[j]*xs_value/generation_weight[i];
+        }
+    }
+}
+
+void Weighter::weight_parallel(const Event* events, size_t n, double* out, ThreadPool& pool, size_t chunk_size) const{
+    if(chunk_size == 0)
+        throw std::runtime_error("Weighter::weight_parallel: chunk size must be positive.");
+    size_t n_chunks = (n+chunk_size-1)/chunk_size;
+    pool.parallel_for(n_chunks,[&](size_t chunk){
+        size_t begin = chunk*chunk_size;
+        weight(events+begin,std::min(chunk_size,n-begin),out+begin);
+    });
+}
+
+void Weighter::weight_parallel(const Event* events, size_t n, double* out, unsigned int n_threads, size_t chunk_size) const{
+    ThreadPool pool(n_threads);
+    weight_parallel(events,n,out,pool,chunk_size);
+}
+
+std::vector<double> Weighter::weight_parallel(const std::vector<Event>& events, unsigned int n_threads, size_t chunk_size) const{
+    std::vector<double> out(events.size());
+    weight_parallel(events.data(),events.size(),out.data(),n_threads,chunk_size);
+    return out;
+}
+
+double Weighter::get_effective_tau_oneweight(const Event & e) const{
     // needs to be a muon-neutrino simulation
     //std::cout << "Begin eff. weight calculation" << std::endl;
     if(not(e.primary_type == ParticleType::NuMu or e.primary_type == ParticleType::NuMuBar)){
@@ -49,7 +448,7 @@ double Weighter::get_effective_tau_oneweight(Event & e) const{
     //std::cout << "Pass secondary check" << std::endl;
     // first compute the generation bias assuming its a muon-neutrino
     double generation_weight = 0;
-    for(auto g : gv){
+    for(const auto& g : gv){
         generation_weight += (*g)(e);
     }
     if(generation_weight == 0){
@@ -59,56 +458,34 @@ double Weighter::get_effective_tau_oneweight(Event & e) const{
     Event e_tau = e;
     // redefine your neutrino vertex
     e_tau.primary_type = (e.primary_type == ParticleType::NuMu) ? ParticleType::NuTau : ParticleType::NuTauBar;
-    e_tau.final_state_particle_0 = (e.primary_type == ParticleType::MuMinus) ? ParticleType::TauMinus : ParticleType::TauPlus;
+    e_tau.final_state_particle_0 = (e.final_state_particle_0 == ParticleType::MuMinus) ? ParticleType::TauMinus : ParticleType::TauPlus;
     e_tau.final_state_particle_1 = ParticleType::Hadrons;
 
-    double y_max = e_tau.interaction_y;
-    double y_min = 0.0;
-    AdaptiveQuad::Options intOpt;
-    nusquids::TauDecaySpectra tds;
-    double int_precision = 1.e-8;
-    double eff_xs = AdaptiveQuad::integrate([&](double y_tau){
-                      double Etau = (1.-y_tau)*e_tau.energy;
-                      double Emu = (1.-e_tau.interaction_y)*e_tau.energy;
-                      if(Emu >= Etau)
-                        return 0.0;
-                      if(y_tau==0.0)
-                        return 0.0;
-                      double dxs = cs->DoubleDifferentialCrossSection(e_tau.primary_type, e_tau.final_state_particle_0, e_tau.final_state_particle_1,
-                                                                      e_tau.energy, e_tau.interaction_x, y_tau);
-                      double dndz = tds.TauDecayToLepton(Etau,Emu)*tds.GetTauToLeptonBranchingRatio();
-                      if(dxs*dndz <0) return 0.0;
-                      double dzdy = e_tau.energy/Etau;
-                      return dxs*dndz*dzdy;
-                    },
-                    y_min, y_max, int_precision, &intOpt);
-    if(intOpt.outOfTolerance){
-        throw std::runtime_error("Integral when computing effective tau cross section did not achieve the requested accuracy.");
-    }
+    double eff_xs;
+    if(not (tau_table and tau_table->get_cross_section() == cs and
+            tau_table->evaluate(e_tau.primary_type, e_tau.final_state_particle_0, e_tau.final_state_particle_1,
+                e_tau.energy, e_tau.interaction_x, e_tau.interaction_y, eff_xs)))
+        eff_xs = EffectiveTauCrossSectionTable::integrate(*cs, e_tau.primary_type, e_tau.final_state_particle_0, e_tau.final_state_particle_1,
+                e_tau.energy, e_tau.interaction_x, e_tau.interaction_y);
     if (eff_xs <0.0)
       return(0.0);
     return eff_xs/generation_weight;
 }
 
-double Weighter::get_effective_tau_weight(Event & e) const{
+double Weighter::get_effective_tau_weight(const Event & e) const{
   if(not(e.primary_type == ParticleType::NuMu or e.primary_type == ParticleType::NuMuBar)){
       throw std::runtime_error("The effective tau weight assumes muon plus shower events as input.");
   }
   double eff_tau_oneweight = get_effective_tau_oneweight(e);
   if(eff_tau_oneweight ==0)
     return 0.0;
-  // here we temporary change the primaryType to tau to get the right flux
-  auto original_primary_type = e.primary_type;
-  if(e.primary_type == ParticleType::NuMu)
-    e.primary_type = ParticleType::NuTau;
-  if(e.primary_type == ParticleType::NuMuBar)
-    e.primary_type = ParticleType::NuTauBar;
+  // the flux is the one of the tau neutrino that would have produced the muon
+  Event e_tau = e;
+  e_tau.primary_type = (e.primary_type == ParticleType::NuMu) ? ParticleType::NuTau : ParticleType::NuTauBar;
   double flux=0.0;
-  for(auto f : fv){
-    flux += (*f)(e);
+  for(const auto& f : fv){
+    flux += (*f)(e_tau);
   }
-  // set things back
-  e.primary_type = original_primary_type;
   return flux*eff_tau_oneweight;
 }
 
@@ -0,0 +1,524 @@
+#include <LeptonWeighter/WeightingPlan.h>
+#include <LeptonWeighter/Constants.h>
+#include <typeinfo>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace LW {
+
+const size_t WeightingPlan::stack_spline_groups;
+
+namespace {
+
+// events per pass of the column functions
+const size_t generation_block = 1024;
+const size_t interaction_block = 256;
+const size_t flux_block = 256;
+
+} // namespace
+
+WeightingPlan::WeightingPlan(std::vector<std::shared_ptr<Flux>> fv_,
+        std::shared_ptr<CrossSection> cs_,
+        std::vector<std::shared_ptr<Generator>> gv_,
+        SplinePrecision precision):
+    fv(std::move(fv_)),cs(std::move(cs_)),gv(std::move(gv_)),precision(precision),index(gv)
+{
+    // exact type matches only, so that user subclasses overriding anything keep their behaviour
+    for(const auto& f : fv){
+        FluxTerm t;
+        t.flux = f.get();
+        if(typeid(*f) == typeid(PowerLawFlux))
+            t.kind = TermKind::PowerLawFlux;
+        else if(typeid(*f) == typeid(ConstantFlux))
+            t.kind = TermKind::ConstantFlux;
+        else
+            t.kind = TermKind::Virtual;
+        flux_terms.push_back(t);
+    }
+
+    if(typeid(*cs) == typeid(CrossSectionFromSpline))
+        cross_section_kind = TermKind::CrossSectionFromSpline;
+    else
+        cross_section_kind = TermKind::Virtual;
+
+    // generators with the same splines share their interaction probability
+    std::vector<std::pair<const photospline::splinetable<>*,const photospline::splinetable<>*>> spline_pairs;
+    for(const auto& g : gv){
+        GeneratorTerm t = make_generator_term(*g);
+        if(t.kind != TermKind::Virtual){
+            auto key = std::make_pair(t.differential_spline,t.total_spline);
+            t.spline_group = std::find(spline_pairs.begin(),spline_pairs.end(),key)-spline_pairs.begin();
+            if(t.spline_group == spline_pairs.size()){
+                spline_pairs.push_back(key);
+                spline_groups.emplace_back(*t.differential_spline,*t.total_spline);
+            }
+        }
+        generator_terms.push_back(t);
+    }
+    n_spline_groups = spline_pairs.size();
+}
+
+WeightingPlan::GeneratorTerm WeightingPlan::make_generator_term(const Generator& g){
+    GeneratorTerm t;
+    t.generator = &g;
+    if(typeid(g) == typeid(RangeGenerator))
+        t.kind = TermKind::RangeGenerator;
+    else if(typeid(g) == typeid(VolumeGenerator))
+        t.kind = TermKind::VolumeGenerator;
+    else {
+        t.kind = TermKind::Virtual;
+        return t;
+    }
+
+    // same expressions as in Generator, evaluated once
+    const SimulationDetails& sd = g.sim_details;
+    t.energy_min = sd.Get_MinEnergy();
+    t.energy_max = sd.Get_MaxEnergy();
+    t.powerlaw_index = sd.Get_PowerLawIndex();
+    t.energy_norm = 0;
+    if(t.powerlaw_index!=1)
+        t.energy_norm=(1-t.powerlaw_index)/(pow(t.energy_max,1-t.powerlaw_index)-pow(t.energy_min,1-t.powerlaw_index));
+    else if(t.powerlaw_index==1)
+        t.energy_norm=1./log(t.energy_max/t.energy_min);
+
+    t.zenith_min = sd.Get_MinZenith();
+    t.zenith_max = sd.Get_MaxZenith();
+    t.azimuth_min = sd.Get_MinAzimuth();
+    t.azimuth_max = sd.Get_MaxAzimuth();
+    t.direction_norm = 1./((t.azimuth_max-t.azimuth_min)*(cos(t.zenith_min)-cos(t.zenith_max)));
+
+    if(t.kind == TermKind::RangeGenerator)
+        t.area = static_cast<const RangeGenerator&>(g).RangeGenerator::probability_area();
+    else
+        t.area = static_cast<const VolumeGenerator&>(g).VolumeGenerator::probability_area();
+
+    t.number_of_events = g.Generator::probability_stat();
+    t.final_state_particle_0 = sd.Get_ParticleType0();
+    t.final_state_particle_1 = sd.Get_ParticleType1();
+    t.differential_spline = sd.Get_DifferentialSpline().get();
+    t.total_spline = sd.Get_TotalSpline().get();
+    return t;
+}
+
+double WeightingPlan::evaluate_flux(const FluxTerm& t, const Event& e){
+    switch(t.kind){
+        case TermKind::PowerLawFlux:
+            return static_cast<const PowerLawFlux*>(t.flux)->PowerLawFlux::EvaluateFlux(e);
+        case TermKind::ConstantFlux:
+            return static_cast<const ConstantFlux*>(t.flux)->ConstantFlux::EvaluateFlux(e);
+        default:
+            return t.flux->EvaluateFlux(e);
+    }
+}
+
+double WeightingPlan::evaluate_flux(const FluxTerm& t, const PreparedEvent& e){
+    if(t.kind == TermKind::Virtual)
+        return t.flux->EvaluateFlux(e);
+    return evaluate_flux(t,static_cast<const Event&>(e));
+}
+
+double WeightingPlan::kinematic_probability(const GeneratorTerm& t, const Event& e){
+    double p = kinematic_probability_except_position(t,e);
+    if(p==0)
+        return 0;
+    if(t.kind == TermKind::VolumeGenerator)
+        p *= static_cast<const VolumeGenerator*>(t.generator)->VolumeGenerator::probability_pos(e.x,e.y,e.z,e.zenith,e.azimuth);
+    return p;
+}
+
+double WeightingPlan::kinematic_probability_except_position(const GeneratorTerm& t, const Event& e){
+    // mirrors Generator::probability factor by factor, including the early returns
+    if(e.energy>t.energy_max or e.energy<t.energy_min)
+        return 0;
+    double p = t.energy_norm*pow(e.energy,-t.powerlaw_index);
+    if(p==0)
+        return 0;
+    if(e.zenith>t.zenith_max or e.zenith<t.zenith_min)
+        return 0;
+    if(e.azimuth>t.azimuth_max or e.azimuth<t.azimuth_min)
+        return 0;
+    p *= t.direction_norm;
+    if(p==0)
+        return 0;
+    p *= t.area;
+    return p;
+}
+
+void WeightingPlan::apply_position_probability(const PositionColumns& positions, std::vector<PositionRows>& rows, double* kinematics) const {
+    PositionColumns term_positions;
+    std::vector<double> position_probability;
+    for(size_t j=0; j<rows.size(); j++){
+        PositionRows& term_rows = rows[j];
+        if(term_rows.events.empty())
+            continue;
+        const VolumeGenerator& g = *static_cast<const VolumeGenerator*>(generator_terms[j].generator);
+        term_positions.gather(positions,term_rows.events.data(),term_rows.events.size());
+        position_probability.resize(term_rows.events.size());
+        g.VolumeGenerator::probability_pos_batch(term_positions,position_probability.data());
+        for(size_t k=0; k<term_rows.events.size(); k++)
+            kinematics[term_rows.slots[k]] *= position_probability[k];
+        term_rows.events.clear();
+        term_rows.slots.clear();
+    }
+}
+
+double WeightingPlan::final_state_probability(const GeneratorTerm& t, const Event& e){
+    if(t.final_state_particle_1 == e.final_state_particle_1 and t.final_state_particle_0 == e.final_state_particle_0)
+        return 1.;
+    if(t.final_state_particle_0 == e.final_state_particle_1 and t.final_state_particle_1 == e.final_state_particle_0)
+        return 1.;
+    return 0.;
+}
+
+bool WeightingPlan::try_interaction_probability(const GeneratorTerm& t, const Event& e, double& probability){
+    const double number_of_targets = Constants::Na*e.total_column_depth;
+    return Generator::try_interaction_probability(*t.differential_spline,*t.total_spline,
+            e.energy,e.interaction_x,e.interaction_y,number_of_targets,probability);
+}
+
+bool WeightingPlan::try_interaction_probability(const GeneratorTerm& t, const PreparedEvent& e, double& probability){
+    const double number_of_targets = Constants::Na*e.event.total_column_depth;
+    return Generator::try_log_interaction_probability(*t.differential_spline,*t.total_spline,
+            e.log10_energy,e.log10_interaction_x,e.log10_interaction_y,number_of_targets,probability);
+}
+
+template<typename EventType>
+bool WeightingPlan::evaluate_generator(const GeneratorTerm& t, const EventType& e, double& interaction, double& probability){
+    probability = 0;
+    const double p = kinematic_probability(t,e);
+    if(p==0)
+        return true;
+    const double final_state = final_state_probability(t,e);
+    if(std::isnan(interaction)){
+        double value;
+        if(not try_interaction_probability(t,e,value))
+            return false;
+        interaction = value;
+    }
+    probability = p*t.number_of_events*final_state*interaction;
+    return true;
+}
+
+bool WeightingPlan::is_neutrino(ParticleType pt){
+    return pt == ParticleType::NuE or pt == ParticleType::NuMu or pt == ParticleType::NuTau or
+        pt == ParticleType::NuEBar or pt == ParticleType::NuMuBar or pt == ParticleType::NuTauBar;
+}
+
+double WeightingPlan::total_flux(const Event& e) const {
+    double flux=0;
+    for(const auto& t : flux_terms)
+        flux += evaluate_flux(t,e);
+    return flux;
+}
+
+double WeightingPlan::total_flux(const PreparedEvent& e) const {
+    double flux=0;
+    for(const auto& t : flux_terms)
+        flux += evaluate_flux(t,e);
+    return flux;
+}
+
+double WeightingPlan::cross_section(const Event& e) const {
+    if(cross_section_kind == TermKind::CrossSectionFromSpline)
+        return static_cast<const CrossSectionFromSpline&>(*cs).CrossSectionFromSpline::DoubleDifferentialCrossSection(
+                e.primary_type, e.final_state_particle_0, e.final_state_particle_1, e.energy, e.interaction_x, e.interaction_y);
+    return (*cs)(e);
+}
+
+double WeightingPlan::cross_section(const PreparedEvent& e) const {
+    if(cross_section_kind == TermKind::CrossSectionFromSpline)
+        return static_cast<const CrossSectionFromSpline&>(*cs).CrossSectionFromSpline::DoubleDifferentialCrossSection(e);
+    return (*cs)(e);
+}
+
+template<typename EventType>
+double WeightingPlan::generation_probability(const EventType& e, double* interaction) const {
+    // generators left out by the index would add exact zeros, candidates keep their order
+    const std::vector<size_t>& candidates = index.candidates(e);
+    for(size_t j : candidates){
+        if(generator_terms[j].kind != TermKind::Virtual)
+            interaction[generator_terms[j].spline_group] = std::numeric_limits<double>::quiet_NaN();
+    }
+    double generation_weight = 0;
+    for(size_t j : candidates){
+        const GeneratorTerm& t = generator_terms[j];
+        if(t.kind == TermKind::Virtual)
+            generation_weight += t.generator->probability(e);
+        else {
+            double probability;
+            if(not evaluate_generator(t,e,interaction[t.spline_group],probability))
+                throw std::runtime_error("Could not evaluate total neutrino cross section spline.");
+            generation_weight += probability;
+        }
+    }
+    return generation_weight;
+}
+
+WeightStatus WeightingPlan::try_generation_probability(const Event& e, double* interaction, double& out) const {
+    const std::vector<size_t>& candidates = index.candidates(e);
+    for(size_t j : candidates){
+        if(generator_terms[j].kind != TermKind::Virtual)
+            interaction[generator_terms[j].spline_group] = std::numeric_limits<double>::quiet_NaN();
+    }
+    double generation_weight = 0;
+    for(size_t j : candidates){
+        const GeneratorTerm& t = generator_terms[j];
+        if(t.kind == TermKind::Virtual){
+            try {
+                generation_weight += t.generator->probability(e);
+            } catch(...) {
+                return WeightStatus::Failed;
+            }
+        } else {
+            double probability;
+            if(not evaluate_generator(t,e,interaction[t.spline_group],probability))
+                return WeightStatus::SplineOutOfRange;
+            generation_weight += probability;
+        }
+    }
+    out = generation_weight;
+    if(generation_weight == 0)
+        return WeightStatus::OutOfPhaseSpace;
+    return WeightStatus::OK;
+}
+
+WeightStatus WeightingPlan::try_generation_probability(const Event& e, double& out) const {
+    if(n_spline_groups <= stack_spline_groups){
+        double interaction[stack_spline_groups];
+        return try_generation_probability(e,interaction,out);
+    }
+    std::vector<double> interaction(n_spline_groups);
+    return try_generation_probability(e,interaction.data(),out);
+}
+
+WeightStatus WeightingPlan::try_total_flux(const Event& e, double& out) const {
+    double flux=0;
+    for(const auto& t : flux_terms){
+        if(t.kind == TermKind::Virtual){
+            try {
+                flux += t.flux->EvaluateFlux(e);
+            } catch(...) {
+                return WeightStatus::Failed;
+            }
+        } else
+            flux += evaluate_flux(t,e);
+    }
+    out = flux;
+    return WeightStatus::OK;
+}
+
+WeightStatus WeightingPlan::try_cross_section(const Event& e, double& out) const {
+    if(cross_section_kind == TermKind::CrossSectionFromSpline){
+        // the only case in which CrossSectionFromSpline throws
+        if(not is_neutrino(e.primary_type))
+            return WeightStatus::BadParticleType;
+        out = cross_section(e);
+        return WeightStatus::OK;
+    }
+    try {
+        out = (*cs)(e);
+    } catch(...) {
+        return WeightStatus::Failed;
+    }
+    return WeightStatus::OK;
+}
+
+template<typename EventType>
+double WeightingPlan::generation_probability_of(const EventType& e) const {
+    if(n_spline_groups <= stack_spline_groups){
+        double interaction[stack_spline_groups];
+        return generation_probability(e,interaction);
+    }
+    std::vector<double> interaction(n_spline_groups);
+    return generation_probability(e,interaction.data());
+}
+
+double WeightingPlan::generation_probability(const Event& e) const {
+    return generation_probability_of(e);
+}
+
+double WeightingPlan::generation_probability(const PreparedEvent& e) const {
+    return generation_probability_of(e);
+}
+
+void WeightingPlan::total_flux(const Event* events, size_t n, double* out) const {
+    std::fill(out,out+n,0.);
+    double flux[flux_block];
+    for(size_t begin=0; begin<n; begin+=flux_block){
+        const size_t block = std::min(flux_block,n-begin);
+        for(const auto& t : flux_terms){
+            switch(t.kind){
+                case TermKind::PowerLawFlux:
+                    static_cast<const PowerLawFlux*>(t.flux)->PowerLawFlux::EvaluateFluxBatch(events+begin,block,flux);
+                    break;
+                case TermKind::ConstantFlux:
+                    static_cast<const ConstantFlux*>(t.flux)->ConstantFlux::EvaluateFluxBatch(events+begin,block,flux);
+                    break;
+                default:
+                    t.flux->EvaluateFluxBatch(events+begin,block,flux);
+            }
+            for(size_t i=0; i<block; i++)
+                out[begin+i] += flux[i];
+        }
+    }
+}
+
+void WeightingPlan::cross_section(const Event* events, size_t n, double* out) const {
+    if(cross_section_kind == TermKind::CrossSectionFromSpline)
+        static_cast<const CrossSectionFromSpline&>(*cs).CrossSectionFromSpline::DoubleDifferentialCrossSectionBatch(events,n,out,precision);
+    else
+        cs->DoubleDifferentialCrossSectionBatch(events,n,out);
+}
+
+void WeightingPlan::interaction_probability(size_t g, const Event* events, const size_t* indices, size_t m, double* out) const {
+    const SplineGroup& group = spline_groups[g];
+    double log_coordinates[3][interaction_block];
+    double differential[interaction_block], total[interaction_block];
+    bool differential_in_range[interaction_block], total_in_range[interaction_block];
+    const double* coordinates[3] = {log_coordinates[0],log_coordinates[1],log_coordinates[2]};
+    for(size_t begin=0; begin<m; begin+=interaction_block){
+        const size_t block = std::min(interaction_block,m-begin);
+        for(size_t k=0; k<block; k++){
+            const Event& e = events[indices[begin+k]];
+            log_coordinates[0][k] = log10(e.energy);
+            log_coordinates[1][k] = log10(e.interaction_x);
+            log_coordinates[2][k] = log10(e.interaction_y);
+        }
+        group.differential.evaluate(coordinates,block,differential,differential_in_range,precision);
+        group.total.evaluate(coordinates,block,total,total_in_range,precision);
+        for(size_t k=0; k<block; k++){
+            if(not (differential_in_range[k] and total_in_range[k]))
+                throw std::runtime_error("Could not evaluate total neutrino cross section spline.");
+            const double number_of_targets = Constants::Na*events[indices[begin+k]].total_column_depth;
+            out[begin+k] = Generator::interaction_probability(differential[k],total[k],number_of_targets);
+        }
+    }
+}
+
+void WeightingPlan::generation_probability(const Event* events, size_t n, double* out) const {
+    // First the kinematic factors of all candidates, which tell for which events each spline
+    // group is needed, then the splines of each group over those events, then the sums.
+    // The position factors of the volume generators are taken in one batch per generator, from
+    // direction sines and cosines computed once per event.
+    std::vector<const std::vector<size_t>*> candidates;
+    std::vector<double> kinematics;
+    std::vector<PositionRows> position_rows(generator_terms.size());
+    PositionColumns positions;
+    std::vector<std::vector<size_t>> needed(n_spline_groups);
+    std::vector<double> interaction(n_spline_groups*generation_block);
+    std::vector<double> group_interaction(generation_block);
+    for(size_t begin=0; begin<n; begin+=generation_block){
+        const size_t block = std::min(generation_block,n-begin);
+        const Event* block_events = events+begin;
+        candidates.clear();
+        kinematics.clear();
+        for(auto& indices : needed)
+            indices.clear();
+        bool any_position = false;
+        for(size_t i=0; i<block; i++){
+            const Event& e = block_events[i];
+            candidates.push_back(&index.candidates(e));
+            for(size_t j : *candidates.back()){
+                const GeneratorTerm& t = generator_terms[j];
+                if(t.kind == TermKind::Virtual)
+                    continue;
+                const double p = kinematic_probability_except_position(t,e);
+                if(p != 0 and t.kind == TermKind::VolumeGenerator){
+                    position_rows[j].events.push_back(i);
+                    position_rows[j].slots.push_back(kinematics.size());
+                    any_position = true;
+                }
+                kinematics.push_back(p);
+            }
+        }
+        if(any_position){
+            positions.assign(block_events,block);
+            apply_position_probability(positions,position_rows,kinematics.data());
+        }
+
+        size_t next = 0;
+        for(size_t i=0; i<block; i++){
+            for(size_t j : *candidates[i]){
+                const GeneratorTerm& t = generator_terms[j];
+                if(t.kind == TermKind::Virtual)
+                    continue;
+                std::vector<size_t>& indices = needed[t.spline_group];
+                if(kinematics[next++] != 0 and (indices.empty() or indices.back() != i))
+                    indices.push_back(i);
+            }
+        }
+
+        for(size_t g=0; g<n_spline_groups; g++){
+            const std::vector<size_t>& indices = needed[g];
+            interaction_probability(g,block_events,indices.data(),indices.size(),group_interaction.data());
+            for(size_t k=0; k<indices.size(); k++)
+                interaction[g*generation_block+indices[k]] = group_interaction[k];
+        }
+
+        next = 0;
+        for(size_t i=0; i<block; i++){
+            const Event& e = block_events[i];
+            double generation_weight = 0;
+            for(size_t j : *candidates[i]){
+                const GeneratorTerm& t = generator_terms[j];
+                if(t.kind == TermKind::Virtual){
+                    generation_weight += t.generator->probability(e);
+                    continue;
+                }
+                const double p = kinematics[next++];
+                double probability = 0;
+                if(p != 0)
+                    probability = p*t.number_of_events*final_state_probability(t,e)*interaction[t.spline_group*generation_block+i];
+                generation_weight += probability;
+            }
+            out[begin+i] = generation_weight;
+        }
+    }
+}
+
+void WeightingPlan::generator_probability(size_t j, const Event* events, size_t n, double* out) const {
+    const GeneratorTerm& t = generator_terms.at(j);
+    if(t.kind == TermKind::Virtual){
+        for(size_t i=0; i<n; i++)
+            out[i] = t.generator->probability(events[i]);
+        return;
+    }
+    std::vector<double> kinematics(n);
+    for(size_t i=0; i<n; i++)
+        kinematics[i] = kinematic_probability_except_position(t,events[i]);
+    if(t.kind == TermKind::VolumeGenerator){
+        std::vector<PositionRows> position_rows(generator_terms.size());
+        for(size_t i=0; i<n; i++){
+            if(kinematics[i] != 0){
+                position_rows[j].events.push_back(i);
+                position_rows[j].slots.push_back(i);
+            }
+        }
+        apply_position_probability(PositionColumns(events,n),position_rows,kinematics.data());
+    }
+    std::vector<size_t> needed;
+    for(size_t i=0; i<n; i++){
+        if(kinematics[i] != 0)
+            needed.push_back(i);
+    }
+    std::vector<double> interaction(needed.size());
+    interaction_probability(t.spline_group,events,needed.data(),needed.size(),interaction.data());
+    std::fill(out,out+n,0.);
+    for(size_t k=0; k<needed.size(); k++){
+        const size_t i = needed[k];
+        out[i] = kinematics[i]*t.number_of_events*final_state_probability(t,events[i])*interaction[k];
+    }
+}
+
+unsigned int WeightingPlan::number_of_virtual_terms() const {
+    unsigned int n_virtual = (cross_section_kind == TermKind::Virtual);
+    for(const auto& t : flux_terms)
+        n_virtual += (t.kind == TermKind::Virtual);
+    for(const auto& t : generator_terms)
+        n_virtual += (t.kind == TermKind::Virtual);
+    return n_virtual;
+}
+
+} // namespace LW
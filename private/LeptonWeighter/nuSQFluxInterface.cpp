@@ -1,4 +1,6 @@
 #include "LeptonWeighter/nuSQFluxInterface.h"
+#include <algorithm>
+#include <cmath>
 
 namespace LW {
 
@@ -29,9 +31,34 @@ std::pair<unsigned int, unsigned int> Convert_PDG_Id_To_nuSQuIDS_Id(ParticleType
     case LW::ParticleType::NuMuBar : flavor = 1;break;
     case LW::ParticleType::NuTau   : flavor = 2;break;
     case LW::ParticleType::NuTauBar: flavor = 2;break;
-    default: std::runtime_error("LeptonWeighter::nuSQFluxInterface: Particle type cannot be converted to a nusquids type.");
+    default: throw std::runtime_error("LeptonWeighter::nuSQFluxInterface: Particle type cannot be converted to a nusquids type.");
   }
   return std::make_pair(flavor,neutype);
 }
 
+std::vector<nuSQuIDSEvaluationPoint> Order_For_nuSQuIDS_Evaluation(const Event* events, size_t n, bool sort_by_zenith){
+  std::vector<nuSQuIDSEvaluationPoint> points(n);
+  for(size_t i=0; i<n; i++){
+    auto nusq_id = Convert_PDG_Id_To_nuSQuIDS_Id(events[i].primary_type);
+    points[i].flavor = nusq_id.first;
+    points[i].neutype = nusq_id.second;
+    // same expression as EvaluateFlux, so that the values do not change
+    points[i].cos_zenith = sort_by_zenith ? cos(events[i].zenith) : 0.;
+    points[i].energy = events[i].energy;
+    points[i].index = i;
+  }
+  std::sort(points.begin(),points.end(),[](const nuSQuIDSEvaluationPoint& a, const nuSQuIDSEvaluationPoint& b){
+    if(a.flavor != b.flavor)
+      return a.flavor < b.flavor;
+    if(a.neutype != b.neutype)
+      return a.neutype < b.neutype;
+    if(a.cos_zenith != b.cos_zenith)
+      return a.cos_zenith < b.cos_zenith;
+    if(a.energy != b.energy)
+      return a.energy < b.energy;
+    return a.index < b.index;
+  });
+  return points;
+}
+
 } // close LW namespace
@@ -73,8 +73,8 @@ BOOST_PYTHON_MODULE(LeptonWeighter)
 
     // abstract generator
     class_<Generator, std::shared_ptr<Generator>, boost::noncopyable>("Generator",no_init)
-        .def("probability",&Generator::probability)
-        .def("__call__",pure_virtual(&Generator::operator()))
+        .def("probability",static_cast<double (Generator::*)(const Event&) const>(&Generator::probability))
+        .def("__call__",pure_virtual(static_cast<double (Generator::*)(const Event&) const>(&Generator::operator())))
         ;
 
     // range generator
@@ -120,7 +120,7 @@ BOOST_PYTHON_MODULE(LeptonWeighter)
     //========================================================//
 
     class_<Flux, std::shared_ptr<Flux>, boost::noncopyable>("Flux",no_init)
-        .def("__call__",pure_virtual(&Flux::operator()))
+        .def("__call__",pure_virtual(static_cast<double (Flux::*)(const Event&) const>(&Flux::operator())))
         ;
 
     class_<ConstantFlux, std::shared_ptr<ConstantFlux>, boost::noncopyable>("ConstantFlux",init<double>(args("Constant flux value in units 1/(GeV cm s sr)")))
@@ -146,7 +146,7 @@ BOOST_PYTHON_MODULE(LeptonWeighter)
     //========================================================//
 
     class_<CrossSection, boost::noncopyable>("CrossSection",no_init)
-        .def("DoubleDifferentialCrossSection",pure_virtual(&CrossSection::DoubleDifferentialCrossSection))
+        .def("DoubleDifferentialCrossSection",pure_virtual(static_cast<double (CrossSection::*)(ParticleType,ParticleType,ParticleType,double,double,double) const>(&CrossSection::DoubleDifferentialCrossSection)))
         ;
     class_<CrossSectionFromSpline, std::shared_ptr<CrossSectionFromSpline>, boost::noncopyable>("CrossSectionFromSpline", 
             init<std::string,std::string,std::string,std::string>(args("CC diff neutrino cross section path", "CC diff antineutrino cross section path","NC diff neutrino cross section path","NC diff antineutrino cross section path")))
@@ -166,15 +166,19 @@ BOOST_PYTHON_MODULE(LeptonWeighter)
         .def(init<std::shared_ptr<Flux>,std::shared_ptr<CrossSection>,std::vector<std::shared_ptr<Generator>>>(args("Flux","Cross section","Vector of generator")))
         .def(init<std::shared_ptr<CrossSection>,std::vector<std::shared_ptr<Generator>>>(args("Cross section","Vector of generator")))
         .def(init<std::shared_ptr<CrossSection>,std::shared_ptr<Generator>>(args("Cross section","Generator")))
-        .def("__call__",&Weighter::operator())
-        .def("weight",&Weighter::weight)
-        .def("get_oneweight",&Weighter::get_oneweight)
+        .def("__call__",static_cast<double (Weighter::*)(const Event&) const>(&Weighter::operator()))
+        .def("weight",static_cast<double (Weighter::*)(const Event&) const>(&Weighter::weight))
+        .def("weight",static_cast<std::vector<double> (Weighter::*)(const std::vector<Event>&) const>(&Weighter::weight))
+        .def("get_oneweight",static_cast<double (Weighter::*)(const Event&) const>(&Weighter::get_oneweight))
+        .def("get_oneweight",static_cast<std::vector<double> (Weighter::*)(const std::vector<Event>&) const>(&Weighter::get_oneweight))
         .def("add_generator",&Weighter::add_generator)
         .def("add_flux",&Weighter::add_flux)
-        .def("get_total_flux",&Weighter::get_total_flux)
-        .def("get_oneweight",&Weighter::get_oneweight)
+        .def("get_total_flux",static_cast<double (Weighter::*)(const Event&) const>(&Weighter::get_total_flux))
+        .def("get_total_flux",static_cast<std::vector<double> (Weighter::*)(const std::vector<Event>&) const>(&Weighter::get_total_flux))
         .def("get_effective_tau_weight",&Weighter::get_effective_tau_weight)
         .def("get_effective_tau_oneweight",&Weighter::get_effective_tau_oneweight)
+        .def("compile",&Weighter::compile)
+        .def("is_compiled",&Weighter::is_compiled)
         ;
 
     //========================================================//
@@ -194,4 +198,7 @@ BOOST_PYTHON_MODULE(LeptonWeighter)
     from_python_sequence< std::vector<std::shared_ptr<LW::Flux>>, variable_capacity_policy >();
     to_python_converter< std::vector<std::shared_ptr<LW::Flux>, class std::allocator<std::shared_ptr<LW::Flux>>>, VecToList<std::shared_ptr<LW::Flux>> > ();
 
+    from_python_sequence< std::vector<LW::Event>, variable_capacity_policy >();
+    to_python_converter< std::vector<double, class std::allocator<double>>, VecToList<double> > ();
+
 } // close boost_python module
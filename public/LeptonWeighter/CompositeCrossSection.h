@@ -0,0 +1,65 @@
+#ifndef LW_COMPOSITECROSSSECTION_H
+#define LW_COMPOSITECROSSSECTION_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "ParticleType.h"
+#include "CrossSection.h"
+
+namespace LW {
+
+///\class
+///\brief Cross section made of several cross sections, each for its own interaction channels
+///\details Every component is added with the channels it describes, given as a primary and an
+/// unordered pair of final state particles, where ParticleType::unknown matches any particle.
+/// An event goes to the components whose matching channel names the most particles, and their
+/// cross sections are added when there are several. So a DIS cross section added for any event
+/// with hadrons in the final state and a Glashow resonance cross section added for its four
+/// final states split a mixed sample between them, and one Weighter weights it in a single pass.
+/// An event no channel matches is an error. The route is found once per event; the batch
+/// function sorts the events by component and hands each component its events in one batch.
+class CompositeCrossSection: public CrossSection {
+    private:
+        struct Channel {
+            ParticleType primary;
+            ParticleType final_state_particle_0;
+            ParticleType final_state_particle_1;
+            // number of particles that are not wildcards
+            unsigned int specificity;
+            size_t component;
+        };
+        std::vector<std::shared_ptr<const CrossSection>> components;
+        std::vector<Channel> channels;
+    private:
+        static bool matches(ParticleType channel_particle, ParticleType particle){
+            return channel_particle == ParticleType::unknown or channel_particle == particle;
+        }
+    public:
+        ///\brief Largest number of components
+        static const size_t max_components = 64;
+        ///\brief Constructor. Starts without components.
+        CompositeCrossSection() {}
+        ///\brief Adds a component for one channel and returns its index
+        size_t add(std::shared_ptr<const CrossSection> cs,
+                ParticleType primary = ParticleType::unknown,
+                ParticleType final_state_particle_0 = ParticleType::unknown, ParticleType final_state_particle_1 = ParticleType::unknown);
+        ///\brief Adds another channel to the component with the given index
+        void add_channel(size_t component, ParticleType primary,
+                ParticleType final_state_particle_0 = ParticleType::unknown, ParticleType final_state_particle_1 = ParticleType::unknown);
+        ///\brief DIS for every final state with hadrons, the Glashow resonance for its leptonic and hadronic W decays
+        static std::shared_ptr<CompositeCrossSection> MakeDISAndGlashowResonance(std::shared_ptr<const CrossSection> dis,
+                std::shared_ptr<const CrossSection> glashow_resonance);
+        ///\brief Components an event goes to, bit i standing for component i. Zero if none.
+        uint64_t route(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1) const;
+        ///\brief Sum of the cross sections of the components the event goes to
+        double DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const override;
+        double DoubleDifferentialCrossSection(const PreparedEvent & e) const override;
+        void DoubleDifferentialCrossSectionBatch(const Event * events, size_t n, double * out) const override;
+        size_t get_number_of_components() const { return components.size();}
+        std::shared_ptr<const CrossSection> get_component(size_t i) const { return components.at(i);}
+};
+
+} // namespace LW
+
+#endif
@@ -6,6 +6,11 @@ namespace Constants {
 
 const double Na = 6.022140857e+23;
 
+// W mass and width in GeV, as nuSQuIDS' Glashow resonance cross section sets them. The other
+// inputs of the closed form are taken from squids::Const, which nuSQuIDS uses as well.
+const double W_mass = 80.385;
+const double W_width = 2.085;
+
 } // namespace Constants
 } // namespace LW
 
@@ -3,12 +3,15 @@
 
 #include <LeptonWeighter/ParticleType.h>
 #include <LeptonWeighter/Event.h>
+#include <LeptonWeighter/PreparedEvent.h>
 #include <LeptonWeighter/MetaWeighter.h>
 #include <LeptonWeighter/Constants.h>
+#include <LeptonWeighter/SplineBatchEvaluator.h>
 #include <nuSQuIDS/xsections.h>
 #include <photospline/splinetable.h>
 #include <photospline/bspline.h>
 #include <memory>
+#include <vector>
 
 namespace LW {
 
@@ -21,18 +24,30 @@ namespace LW {
 
 ///\class
 ///\brief Abstract cross section class
+///\details DoubleDifferentialCrossSection may be called from several threads at once on the same object.
 class CrossSection: public MetaWeighter<CrossSection> {
     public:
         virtual double DoubleDifferentialCrossSection(ParticleType pt, ParticleType f0, ParticleType f1, double energy, double x, double y) const = 0;
+        ///\brief Cross section of a prepared event. The default ignores the cached quantities.
+        virtual double DoubleDifferentialCrossSection(const PreparedEvent & e) const {
+            return DoubleDifferentialCrossSection(e.event.primary_type, e.event.final_state_particle_0, e.event.final_state_particle_1, e.event.energy, e.event.interaction_x, e.event.interaction_y);
+        }
+        ///\brief Cross sections of n events. The default evaluates them one at a time.
+        virtual void DoubleDifferentialCrossSectionBatch(const Event * events, size_t n, double * out) const;
 
         template<typename Event>
         double operator()(const Event& e) const {
             return DoubleDifferentialCrossSection(e.primary_type, e.final_state_particle_0, e.final_state_particle_1, e.energy, e.interaction_x, e.interaction_y);
         }
+        double operator()(const PreparedEvent& e) const {
+            return DoubleDifferentialCrossSection(e);
+        }
 };
 
 ///\class
 ///\brief Cross section from spline class
+///\details Safe to share between threads: photospline evaluation only reads the tables and keeps its
+/// work space on the stack.
 class CrossSectionFromSpline: public CrossSection {
     private:
         bool is_charged_lepton(ParticleType pt) const;
@@ -40,28 +55,112 @@ class CrossSectionFromSpline: public CrossSection {
     private:
         // photospline objects
         using splinetable=photospline::splinetable<>;
-        std::shared_ptr<splinetable> nu_CC_dsdxdy;
-        std::shared_ptr<splinetable> nubar_CC_dsdxdy;
-        std::shared_ptr<splinetable> nu_NC_dsdxdy;
-        std::shared_ptr<splinetable> nubar_NC_dsdxdy;
+        std::shared_ptr<const splinetable> nu_CC_dsdxdy;
+        std::shared_ptr<const splinetable> nubar_CC_dsdxdy;
+        std::shared_ptr<const splinetable> nu_NC_dsdxdy;
+        std::shared_ptr<const splinetable> nubar_NC_dsdxdy;
+        // batch evaluation of the tables above, in the order nu CC, nubar CC, nu NC, nubar NC
+        std::vector<SplineBatchEvaluator> batch_evaluators;
     public:
-        ///\brief Constructor
+        ///\brief Constructor. The tables are read through SplineRegistry::global, so cross sections and
+        /// generators built from identical FITS files share them.
         CrossSectionFromSpline(std::string differential_neutrino_CC_xs_spline_path, std::string differential_antineutrino_CC_xs_spline_path,
                 std::string differential_neutrino_NC_xs_spline_path, std::string differential_antineutrino_NC_xs_spline_path);
         ///\brief Returns double differential cross section in cm^2.
         double DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const override;
+        ///\brief Same as above, reading the logarithms and the channel from the prepared event.
+        double DoubleDifferentialCrossSection(const PreparedEvent & e) const override;
+        ///\brief Returns the double differential cross sections of n events in cm^2.
+        ///\details The events are sorted by table and each table is evaluated with a SplineBatchEvaluator,
+        /// so the results are the same as from DoubleDifferentialCrossSection.
+        void DoubleDifferentialCrossSectionBatch(const Event * events, size_t n, double * out) const override;
+        ///\brief Same as above in the given precision
+        ///\details The object has no precision setting of its own; single precision is only used where a
+        /// caller asks for it, as a Weighter does after Weighter::enable_single_precision.
+        void DoubleDifferentialCrossSectionBatch(const Event * events, size_t n, double * out, SplinePrecision precision) const;
+        ///\brief Compares the single to the double precision batch evaluation at the given events
+        ///\details accepted tells if the largest relative deviation of the cross sections is within tolerance.
+        SinglePrecisionAccuracy check_single_precision(const Event * events, size_t n, double tolerance = 1.e-5) const;
+        ///\brief Largest difference in ulps between the double precision batch and the single event cross
+        /// sections at the given events, zero unless the build changes the floating point rounding
+        uint64_t max_batch_ulp_difference(const Event * events, size_t n) const;
 };
 
 ///\class
-///\brief Cross section from spline class
+///\brief Accuracy of the closed form Glashow resonance cross section against nuSQuIDS
+struct GlashowResonanceAccuracy {
+    /// number of points compared
+    size_t n_samples = 0;
+    /// largest and mean relative deviation from nuSQuIDS
+    double max_relative_error = 0;
+    double mean_relative_error = 0;
+    /// whether the deviation stayed within the tolerance, so that the closed form is used
+    bool accepted = false;
+};
+
+///\class
+///\brief Glashow resonance cross section class
+///\details The differential cross section of anti electron neutrino electron scattering through an
+/// on-shell W, dsigma/dy = 2 G_F^2 m_e E/pi (1-y)^2 (1-(m_mu^2-m_e^2)/(2 m_e E))^2 / ((1-2 m_e E/M_W^2)^2 + Gamma_W^2/M_W^2)
+/// for the muon channel (Gandhi et al., Astropart. Phys. 5 (1996) 81), is evaluated in closed form,
+/// with the Fermi constant and lepton masses of squids::Const that nuSQuIDS uses, and scaled to the final state by a table of W branching ratios. It is only used after
+/// enable_closed_form found it to agree with the nuSQuIDS resonance cross section; until then every
+/// call goes to nuSQuIDS. resources/example/glashow_validation.cpp reports the agreement with the
+/// installed nuSQuIDS. Safe to share between threads; call enable_closed_form before sharing it.
 class GlashowResonanceCrossSection: public CrossSection {
     private:
         nusquids::GlashowResonanceCrossSection grxs;
+        const double cm2_to_m2 = 1.e-4; //convert from nuSQuIDs units to LW units!
+        // W branching ratio of the final state over the muon one, see final_state_index
+        double final_state_scale[5];
+        // closed form dsigma/dE_out of the muon channel, without the final state scale
+        struct Resonance {
+            // nuSQuIDS' dsigma/dE_out times cm2_to_m2, without the energy dependence
+            double coefficient;
+            // 2 m_e/M_W^2, Gamma_W^2/M_W^2 and (m_mu^2-m_e^2)/(2 m_e), the muon channel threshold energy
+            double inverse_resonance_energy;
+            double width_term;
+            double muon_threshold;
+            // only meaningful where inside is true
+            double value(double energy, double y) const {
+                const double one_minus_y = 1.-y;
+                const double muon = 1.-muon_threshold/energy;
+                const double off_resonance = 1.-energy*inverse_resonance_energy;
+                return coefficient*one_minus_y*one_minus_y*muon*muon/(off_resonance*off_resonance+width_term);
+            }
+            bool inside(double energy, double y) const {
+                return y >= 0 and y <= 1 and energy > muon_threshold;
+            }
+            double operator()(double energy, double y) const {
+                return inside(energy,y) ? value(energy,y) : 0.;
+            }
+        };
+        Resonance resonance;
+        bool closed_form;
+    private:
+        static unsigned int final_state_index(ParticleType final_state_particle_0);
+        // nuSQuIDS dsigma/dE_out of the muon channel, in cm^2/eV
+        double nusquids_cross_section(double energy, double y) const;
     public:
-        ///\brief Constructor
-        GlashowResonanceCrossSection(){}
+        ///\brief Constructor. Evaluates nuSQuIDS until enable_closed_form is called.
+        GlashowResonanceCrossSection();
+        using CrossSection::DoubleDifferentialCrossSection;
         ///\brief Returns single differential cross section in cm^2. The x-argument is ignored;
         double DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const override;
+        ///\brief Batch version, a loop without branches on the data when the closed form is used
+        void DoubleDifferentialCrossSectionBatch(const Event * events, size_t n, double * out) const override;
+        ///\brief Compares the closed form to nuSQuIDS at n_samples random points with energies
+        /// log-uniform between energy_min and energy_max in GeV and y uniform. accepted is left false.
+        ///\details A point where the deviation is NaN counts as an infinite deviation, as in enable_closed_form.
+        GlashowResonanceAccuracy validate(unsigned int n_samples, double energy_min = 1.e5, double energy_max = 1.e8, unsigned int seed = 0) const;
+        ///\brief Switches to the closed form if it agrees with nuSQuIDS within the relative tolerance
+        ///\details The two are compared on a grid of 301 energies log-uniform between 1e5 and 1e8 GeV,
+        /// across the resonance, times 21 values of y. If the largest deviation exceeds the tolerance, or
+        /// is NaN anywhere, the cross section keeps evaluating nuSQuIDS.
+        GlashowResonanceAccuracy enable_closed_form(double tolerance = 1.e-5);
+        void disable_closed_form() { closed_form = false;}
+        ///\brief Returns false if the cross section is evaluated with nuSQuIDS
+        bool is_closed_form() const { return closed_form;}
 };
 
 } // namespace LW
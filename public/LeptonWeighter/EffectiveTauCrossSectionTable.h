@@ -0,0 +1,76 @@
+#ifndef LW_EFFECTIVETAUCROSSSECTIONTABLE_H
+#define LW_EFFECTIVETAUCROSSSECTIONTABLE_H
+
+#include <vector>
+#include <memory>
+#include "ParticleType.h"
+#include "GridInterpolation.h"
+#include "CrossSection.h"
+
+namespace LW {
+
+///\class
+///\brief Tabulated effective tau cross section
+///\details The effective cross section for a tau neutrino interaction whose tau decays to a muon
+/// carrying the fraction 1-y_mu of the neutrino energy, integrated over the tau inelasticity.
+/// It is tabulated for tau neutrinos and antineutrinos on a grid that is regular in log10(E),
+/// log10(x) and y_mu. Between nodes it is interpolated trilinearly in log(cross section),
+/// or linearly where a corner is not positive. When the table is built, the interpolation at
+/// the center of every cell is checked against the integral; cells that miss the tolerance,
+/// typically next to the kinematic zeros at y_mu = 0 and 1, are not used. Points in those
+/// cells or outside the grid fall back to the exact integral.
+class EffectiveTauCrossSectionTable {
+    private:
+        std::shared_ptr<const CrossSection> cs;
+        double log10_energy_min, log10_energy_max;
+        double log10_x_min, log10_x_max;
+        double y_min, y_max;
+        unsigned int n_energy, n_x, n_y;
+        // node values, neutrinos first, then antineutrinos; y runs fastest
+        std::vector<double> values;
+        // log of the node values, NaN where the value is not positive
+        std::vector<double> log_values;
+        // cells whose center agrees with the integral within the tolerance
+        std::vector<char> cell_trusted;
+        size_t n_trusted_cells;
+    private:
+        size_t node(unsigned int nubar, unsigned int i, unsigned int j, unsigned int k) const {
+            return ((static_cast<size_t>(nubar)*n_energy+i)*n_x+j)*n_y+k;
+        }
+        size_t cell(unsigned int nubar, unsigned int i, unsigned int j, unsigned int k) const {
+            return ((static_cast<size_t>(nubar)*(n_energy-1)+i)*(n_x-1)+j)*(n_y-1)+k;
+        }
+        double interpolate(unsigned int nubar, unsigned int i, unsigned int j, unsigned int k, double fi, double fj, double fk) const;
+        // primary and final state the table holds, see Weighter::get_effective_tau_oneweight
+        static bool tabulated_channel(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1, unsigned int & nubar);
+    public:
+        ///\brief Constructor. Computes the integral at every node, so it takes a while.
+        ///@param cs cross section the effective cross section is computed with
+        ///@param n_energy number of nodes in log10(E/GeV) between log10_energy_min and log10_energy_max, and so on
+        ///@param tolerance largest relative error accepted at a cell center. Zero or less skips the check.
+        EffectiveTauCrossSectionTable(std::shared_ptr<const CrossSection> cs,
+                double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+                double log10_x_min, double log10_x_max, unsigned int n_x,
+                double y_min, double y_max, unsigned int n_y,
+                double tolerance = 1.e-3);
+        ///\brief Exact effective cross section by adaptive quadrature, what the table is built from
+        static double integrate(const CrossSection & cs, ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+                double energy, double x, double y);
+        ///\brief Interpolates the table. Returns false if the point or channel is not tabulated.
+        bool evaluate(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+                double energy, double x, double y, double & effective_cross_section) const;
+        ///\brief Interpolates the table, computing the integral for points that are not tabulated
+        double operator()(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+                double energy, double x, double y) const;
+        ///\brief Compares the table to the integral at n_samples random points inside the grid
+        ///\details Points in cells that failed the tolerance check are only counted as fallbacks, so this is the accuracy of the values the table returns.
+        TableAccuracy validate(unsigned int n_samples, unsigned int seed = 0) const;
+        ///\brief Fraction of the cells that passed the tolerance check
+        double trusted_fraction() const { return static_cast<double>(n_trusted_cells)/cell_trusted.size();}
+        ///\brief Cross section the table was built from
+        std::shared_ptr<const CrossSection> get_cross_section() const { return cs;}
+};
+
+} // namespace LW
+
+#endif
@@ -2,9 +2,12 @@
 #define LW_FLUX_H
 
 #include <math.h>
+#include <cstddef>
+#include <stdexcept>
 #include <LeptonWeighter/MetaWeighter.h>
 #include <LeptonWeighter/ParticleType.h>
 #include <LeptonWeighter/Event.h>
+#include <LeptonWeighter/PreparedEvent.h>
 
 /*
 "Probablemente de todos nuestros sentimientos el único que no es verdaderamente
@@ -15,28 +18,59 @@ namespace LW {
 
 ///\class
 ///\brief Abstract flux class
+///\details EvaluateFlux and EvaluateFluxGradient may be called from several threads at once on the
+/// same object, e.g. by Weighter::weight_parallel, so they must not modify shared state unguarded.
 class Flux: public MetaWeighter<Flux> {
     public:
         using result_type=double;
         virtual result_type EvaluateFlux(const Event&) const = 0;
+        ///\brief Flux of a prepared event. The default ignores the cached quantities.
+        virtual result_type EvaluateFlux(const PreparedEvent& e) const { return EvaluateFlux(static_cast<const Event&>(e));};
         result_type operator()(const Event& e) const { return EvaluateFlux(e);};
+        result_type operator()(const PreparedEvent& e) const { return EvaluateFlux(e);};
+        ///\brief Fluxes of n events. The default calls EvaluateFlux on each; overrides must return the same values.
+        virtual void EvaluateFluxBatch(const Event * events, size_t n, double * out) const {
+            for(size_t i=0; i<n; i++)
+                out[i] = EvaluateFlux(events[i]);
+        }
+        ///\brief Number of parameters EvaluateFluxGradient differentiates with respect to.
+        virtual unsigned int GetNumberOfParameters() const { return 0; }
+        ///\brief Returns the flux and writes its derivative with respect to each parameter to gradient.
+        virtual result_type EvaluateFluxGradient(const Event& e, double * gradient) const {
+            if(GetNumberOfParameters() != 0)
+                throw std::runtime_error("Flux::EvaluateFluxGradient: flux declares parameters but does not implement their gradient.");
+            return EvaluateFlux(e);
+        }
 };
 
 ///\class
 ///\brief Constant trivial flux class
+///\details The only parameter is the constant. Immutable, safe to share between threads.
 class ConstantFlux: public Flux {
     private:
         const double c;
     public:
         using result_type = double;
+        using Flux::EvaluateFlux;
         result_type EvaluateFlux(const Event& e) const override {
             return c;
         };
+        void EvaluateFluxBatch(const Event * events, size_t n, double * out) const override {
+            for(size_t i=0; i<n; i++)
+                out[i] = c;
+        }
+        unsigned int GetNumberOfParameters() const override { return 1; }
+        result_type EvaluateFluxGradient(const Event& e, double * gradient) const override {
+            gradient[0] = 1.;
+            return c;
+        };
         explicit ConstantFlux(double c): c(c) {};
 };
 
 ///\class
 ///\brief PowerLawFlux trivial flux class
+///\details Parameters are normalization, spectral index and pivot point, in that order.
+/// Immutable, safe to share between threads.
 class PowerLawFlux: public Flux {
     private:
         const double normalization;
@@ -44,9 +78,24 @@ class PowerLawFlux: public Flux {
         const double pivot_point;
     public:
         using result_type = double;
+        using Flux::EvaluateFlux;
         result_type EvaluateFlux(const Event& e) const override {
             return normalization*pow(e.energy/pivot_point,spectral_index);
         };
+        ///\brief Same values as EvaluateFlux, in one loop without virtual calls
+        void EvaluateFluxBatch(const Event * events, size_t n, double * out) const override {
+            for(size_t i=0; i<n; i++)
+                out[i] = normalization*pow(events[i].energy/pivot_point,spectral_index);
+        }
+        unsigned int GetNumberOfParameters() const override { return 3; }
+        result_type EvaluateFluxGradient(const Event& e, double * gradient) const override {
+            const double shape = pow(e.energy/pivot_point,spectral_index);
+            const double flux = normalization*shape;
+            gradient[0] = shape;
+            gradient[1] = flux*log(e.energy/pivot_point);
+            gradient[2] = -spectral_index*flux/pivot_point;
+            return flux;
+        };
         explicit PowerLawFlux(double normalization, double spectral_index, double pivot_point=1e5): normalization(normalization), spectral_index(spectral_index), pivot_point(pivot_point) {};
 };
 
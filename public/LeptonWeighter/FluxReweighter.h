@@ -0,0 +1,50 @@
+#ifndef LW_FLUXREWEIGHTER_H
+#define LW_FLUXREWEIGHTER_H
+
+#include <vector>
+#include <memory>
+#include "Flux.h"
+#include "CrossSection.h"
+#include "Event.h"
+#include "Generator.h"
+#include "Weighter.h"
+
+namespace LW {
+
+///\class
+///\brief Flux only reweighting of a fixed event sample
+///\details The oneweight of every event is computed once and kept. Applying a new set of
+/// fluxes then only costs the flux evaluation. The cross section and generators the column was
+/// computed with are remembered, so the cache can tell which events went stale when they change.
+class FluxReweighter {
+    private:
+        std::vector<Event> events;
+        std::vector<double> oneweight;
+        std::shared_ptr<const CrossSection> cs;
+        std::vector<std::shared_ptr<Generator>> gv;
+    private:
+        // marks the events whose cached oneweight is no longer valid for w
+        size_t find_stale_events(const Weighter & w, std::vector<bool> & stale) const;
+    public:
+        ///\brief Constructor. Computes the oneweight column with the cross section and generators of w.
+        FluxReweighter(const Weighter & w, std::vector<Event> events);
+        ///\brief Returns the number of cached events
+        size_t size() const { return events.size();}
+        const std::vector<Event> & get_events() const { return events;}
+        const std::vector<double> & get_oneweight() const { return oneweight;}
+        ///\brief Returns how many events need their oneweight recomputed to be used with w
+        ///\details A changed cross section invalidates every event. A changed generator list only
+        /// invalidates the events inside the phase space of the generators that were added or removed.
+        size_t stale_events(const Weighter & w) const;
+        ///\brief Recomputes the stale part of the oneweight column for the cross section and generators of w
+        ///\return the number of events that were recomputed
+        size_t update(const Weighter & w);
+        ///\brief Flux only pass: weight = total flux times the cached oneweight
+        void weight(const std::vector<std::shared_ptr<Flux>> & fluxes, double * out) const;
+        std::vector<double> weight(const std::vector<std::shared_ptr<Flux>> & fluxes) const;
+        std::vector<double> weight(std::shared_ptr<Flux> flux) const;
+};
+
+} // namespace LW
+
+#endif
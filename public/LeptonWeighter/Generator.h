@@ -8,9 +8,12 @@
 
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <math.h>
 #include <photospline/splinetable.h>
 #include <LeptonWeighter/MetaWeighter.h>
 #include <LeptonWeighter/Event.h>
+#include <LeptonWeighter/PreparedEvent.h>
 #include <LeptonWeighter/Utils.h>
 #include <LeptonWeighter/LeptonInjectorConfigReader.h>
 #include <nuSQuIDS/xsections.h>
@@ -32,15 +35,15 @@ class SimulationDetails {
         const double energyMin;
         const double energyMax;
         const double powerlawIndex;
-        std::shared_ptr<photospline::splinetable<>> differential_cross_section_spline;
-        std::shared_ptr<photospline::splinetable<>> total_cross_section_spline;
+        std::shared_ptr<const photospline::splinetable<>> differential_cross_section_spline;
+        std::shared_ptr<const photospline::splinetable<>> total_cross_section_spline;
     protected:
         static bool CheckParticleEnumeration(EnumDefBlock) {return true;} // Let's believe. CAD
     public:
         ///\brief Constructor
         SimulationDetails(unsigned long numberOfEvents,
                 ParticleType final_state_particle_0, ParticleType final_state_particle_1,
-                std::shared_ptr<photospline::splinetable<>> differential_cross_section_spline, std::shared_ptr<photospline::splinetable<>> total_cross_section_spline,
+                std::shared_ptr<const photospline::splinetable<>> differential_cross_section_spline, std::shared_ptr<const photospline::splinetable<>> total_cross_section_spline,
                 unsigned int year,
                 double azimuthMin, double azimuthMax,
                 double zenithMin, double zenithMax,
@@ -101,6 +104,9 @@ class RangeSimulationDetails : public SimulationDetails{
         ///\brief Constructor from file
         explicit RangeSimulationDetails(const std::string & configuration_filename): RangeSimulationDetails(ReadFromFile(configuration_filename)){}
         static RangeSimulationDetails MakeFromRangeInjectorConfiguration(const RangedInjectionConfiguration);
+        ///\brief Same as above, with the cross section splines already read, so that they can be shared
+        static RangeSimulationDetails MakeFromRangeInjectorConfiguration(const RangedInjectionConfiguration&,
+                std::shared_ptr<const photospline::splinetable<>> differential_cross_section_spline, std::shared_ptr<const photospline::splinetable<>> total_cross_section_spline);
     public:
         ///\brief Return injection radius in meters
         double Get_InjectionRadius() const { return injectionRadius;}
@@ -128,14 +134,41 @@ class VolumeSimulationDetails : public SimulationDetails{
         ///\brief Constructor from file
         explicit VolumeSimulationDetails(const std::string & configuration_filename): VolumeSimulationDetails(ReadFromFile(configuration_filename)){}
         static VolumeSimulationDetails MakeFromVolumeInjectorConfiguration(const VolumeInjectionConfiguration);
+        ///\brief Same as above, with the cross section splines already read, so that they can be shared
+        static VolumeSimulationDetails MakeFromVolumeInjectorConfiguration(const VolumeInjectionConfiguration&,
+                std::shared_ptr<const photospline::splinetable<>> differential_cross_section_spline, std::shared_ptr<const photospline::splinetable<>> total_cross_section_spline);
     public:
         double Get_CylinderHeight() const { return cylinderHeight;}
         double Get_CylinderRadius() const { return cylinderRadius;}
 };
 
+///\class
+///\brief Vertex positions and direction sines and cosines of a batch of events, one column each
+///\details The input of VolumeGenerator::probability_pos_batch. The trigonometric functions are
+/// evaluated once per event here, so that all volume generators share them.
+struct PositionColumns {
+    std::vector<double> x, y, z;
+    std::vector<double> cos_zenith, sin_zenith, cos_azimuth, sin_azimuth;
+    PositionColumns() {}
+    PositionColumns(const Event * events, size_t n) { assign(events,n);}
+    ///\brief Fills the columns from n events
+    void assign(const Event * events, size_t n);
+    ///\brief Fills the columns with the rows of other at the m given indices
+    void gather(const PositionColumns & other, const size_t * indices, size_t m);
+    size_t size() const { return x.size();}
+};
+
 ///\class
 ///\brief Generator abstract class
+///\details probability may be called from several threads at once on the same object. The library
+/// generators are immutable after construction and evaluate their splines read-only, so they are safe
+/// to share between threads.
+/// The PreparedEvent probability_interaction calls the four argument one, so that a subclass
+/// overriding only that one is used for prepared events too. A compiled Weighter evaluates the
+/// splines of the library generators from the cached logarithms instead, see WeightingPlan.
 class Generator: public MetaWeighter<Generator> {
+    friend class WeightingPlan;
+    friend class PhaseSpaceIndex;
     private:
         nusquids::GlashowResonanceCrossSection grxs;
     protected:
@@ -149,25 +182,49 @@ class Generator: public MetaWeighter<Generator> {
         virtual double probability_pos(double x, double y, double z,double zenith, double azimuth) const = 0;
         virtual double probability_interaction(double e, double y, double number_of_targets) const;
         virtual double probability_interaction(double e, double x, double y, double number_of_targets) const;
+        virtual double probability_interaction(const PreparedEvent & e, double number_of_targets) const;
         virtual double get_eff_height(double x, double y, double z, double zenith, double azimuth) const = 0;
-        virtual double number_of_targets(Event& e) const = 0;
+        virtual double number_of_targets(const Event& e) const = 0;
+        // product of the factors before the interaction, zero as soon as one is
+        double probability_kinematics(const Event & e) const;
+        // interaction probability given the differential and total cross section splines
+        static double interaction_probability(const photospline::splinetable<> & differential_spline, const photospline::splinetable<> & total_spline,
+                double e, double x, double y, double number_of_targets);
+        // same as above, but returns false instead of throwing when a spline cannot be evaluated
+        static bool try_interaction_probability(const photospline::splinetable<> & differential_spline, const photospline::splinetable<> & total_spline,
+                double e, double x, double y, double number_of_targets, double & probability);
+        // same as above, taking log10 of the energy, x and y
+        static bool try_log_interaction_probability(const photospline::splinetable<> & differential_spline, const photospline::splinetable<> & total_spline,
+                double log10_e, double log10_x, double log10_y, double number_of_targets, double & probability);
+        // the combination of the spline values the two functions above return
+        static double interaction_probability(double log10_differential_xs, double log10_total_xs, double number_of_targets){
+            return pow(10.0,log10_differential_xs)/(1. - exp(-pow(10.0,log10_total_xs)*number_of_targets));
+        }
     public:
         ///\brief Constructor
         explicit Generator(SimulationDetails sim_details):sim_details(sim_details){}
         ///\brief Return the probability of generating the event
-        double probability(Event & e) const;
-        double operator()(Event & e) const { return probability(e);}
+        double probability(const Event & e) const;
+        ///\brief Same as above, with the interaction from the PreparedEvent probability_interaction
+        ///\details The library generators evaluate it from the plain fields of the event, as above;
+        /// a subclass may override that probability_interaction to read the cached quantities.
+        double probability(const PreparedEvent & e) const;
+        double operator()(const Event & e) const { return probability(e);}
+        double operator()(const PreparedEvent & e) const { return probability(e);}
+        ///\brief Returns false if the event energy, direction or final state was not generated, i.e. the probability is zero
+        bool in_phase_space(const Event & e) const;
 };
 
 ///\class
 ///\brief RangeGenerator class
 class RangeGenerator: public Generator {
+    friend class WeightingPlan;
     const RangeSimulationDetails range_sim_details;
     protected:
     double probability_area() const override;
     double probability_pos(double x, double y, double z, double zenith, double azimuth) const override {return 1;}
     double get_eff_height(double x, double y, double z, double zenith, double azimuth) const override {return 1;}
-    virtual double number_of_targets(Event& e) const override;
+    virtual double number_of_targets(const Event& e) const override;
     public:
     ///\brief Constructor
     explicit RangeGenerator(RangeSimulationDetails sim_details):Generator(sim_details),range_sim_details(sim_details){};
@@ -177,18 +234,28 @@ class RangeGenerator: public Generator {
 ///\class
 ///\brief VolumeGenerator class
 class VolumeGenerator: public Generator {
+    friend class WeightingPlan;
     const VolumeSimulationDetails vol_sim_details;
     protected:
     double probability_area() const override {return 1;}
     double probability_pos(double x, double y, double z, double zenith, double azimuth) const override;
     double get_eff_height(double x, double y, double z, double zenith, double azimuth) const override;
-    virtual double number_of_targets(Event& e) const override;
+    virtual double number_of_targets(const Event& e) const override;
     public:
     ///\brief Constructor
     explicit VolumeGenerator(VolumeSimulationDetails sim_details):Generator(sim_details),vol_sim_details(sim_details){};
+    ///\brief get_eff_height of every row of columns, bit-identical to it
+    ///\details The cylinder and endcap intersections are both computed and the right ones selected,
+    /// so the loop has no branches on the data and vectorizes.
+    void get_eff_height_batch(const PositionColumns & columns, double * out) const;
+    ///\brief probability_pos of every row of columns, bit-identical to it
+    void probability_pos_batch(const PositionColumns & columns, double * out) const;
     VolumeSimulationDetails GetVolumeSimulationDetails() {return vol_sim_details;}
 };
 
+///\brief Reads all generators in a .lic file. The cross section tables are read through
+/// SplineRegistry::global, so byte identical tables are shared by all generators that embed them,
+/// in this file or any other one.
 std::vector<std::shared_ptr<Generator>> MakeGeneratorsFromLICFile(std::string filename);
 std::vector<std::shared_ptr<Generator>> MakeGeneratorsFromH5File(std::string filename);
 
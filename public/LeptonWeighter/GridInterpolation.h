@@ -0,0 +1,73 @@
+#ifndef LW_GRIDINTERPOLATION_H
+#define LW_GRIDINTERPOLATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace LW {
+
+///\class
+///\brief Accuracy of a tabulated quantity against the exact one it tabulates
+///\details Filled by the validate methods of TabulatedCrossSection, TabulatedFlux and
+/// EffectiveTauCrossSectionTable, one sample at a time.
+struct TableAccuracy {
+    /// number of points the table answered
+    size_t n_samples = 0;
+    /// number of points that fell back to the exact quantity
+    size_t n_fallback = 0;
+    /// largest and mean relative deviation of the table from the exact quantity
+    double max_relative_error = 0;
+    double mean_relative_error = 0;
+
+    /// records a point the table answered with tabulated where the exact value is exact
+    void add(double tabulated, double exact){
+        double relative_error = exact != 0 ? std::abs(tabulated-exact)/std::abs(exact) : std::abs(tabulated);
+        max_relative_error = std::max(max_relative_error,relative_error);
+        n_samples++;
+        mean_relative_error += (relative_error-mean_relative_error)/n_samples;
+    }
+    /// records a point the table did not answer
+    void add_fallback(){ n_fallback++; }
+};
+
+namespace grid {
+
+///\brief Position of value on a regular axis from min to max with n nodes
+///\details Sets the index of the cell and the fraction inside it; returns false outside the axis.
+inline bool locate(double value, double min, double max, unsigned int n, unsigned int& cell, double& fraction){
+    double u = (value-min)/(max-min)*(n-1);
+    if(not (u >= 0 and u <= n-1))
+        return false;
+    cell = std::min(static_cast<unsigned int>(u),n-2);
+    fraction = u-cell;
+    return true;
+}
+
+///\brief Nodes and weights of linear interpolation at fraction f of cell
+inline void linear_stencil(unsigned int cell, double f, unsigned int nodes[2], double weights[2]){
+    nodes[0] = cell;
+    nodes[1] = cell+1;
+    weights[0] = 1-f;
+    weights[1] = f;
+}
+
+///\brief Nodes and weights of the Catmull-Rom stencil at fraction f of cell on an axis of n nodes
+///\details The outer nodes are clamped at the ends of the axis.
+inline void catmull_rom_stencil(unsigned int cell, unsigned int n, double f, unsigned int nodes[4], double weights[4]){
+    nodes[0] = std::max(cell,1u)-1;
+    nodes[1] = cell;
+    nodes[2] = cell+1;
+    nodes[3] = std::min(cell+2,n-1);
+    const double f2 = f*f, f3 = f2*f;
+    weights[0] = 0.5*(-f3+2*f2-f);
+    weights[1] = 0.5*(3*f3-5*f2+2);
+    weights[2] = 0.5*(-3*f3+4*f2+f);
+    weights[3] = 0.5*(f3-f2);
+}
+
+} // namespace grid
+
+} // namespace LW
+
+#endif
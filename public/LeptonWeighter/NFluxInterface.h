@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <LeptonWeighter/Flux.h>
+#include <LeptonWeighter/TabulatedFlux.h>
 #include <LeptonWeighter/Utils.h>
 #include <nuflux/nuflux.h>
 #include <boost/shared_ptr.hpp>
@@ -37,22 +38,43 @@ namespace LW {
 
   ///\class
   ///\brief class to interface nuflux with LeptonWeighter
+  ///\details nuflux fluxes are evaluated through const methods that only read their tables, so this is
+  /// safe to share between threads as long as the wrapped flux is not reconfigured meanwhile.
+  /// EvaluateFluxBatch sorts the events by primary type and calls the nuflux flux in one loop per type.
+  /// A table set with enable_table, or built by it, answers instead of the nuflux flux wherever it can,
+  /// see TabulatedFlux; set it before sharing the object between threads.
   class atmosNeutrinoFlux: public Flux {
   private:
     bool nugen_compatible;
     std::shared_ptr<nuflux::FluxFunction> flux;
+    std::shared_ptr<const TabulatedFlux> table;
   public:
     virtual ~atmosNeutrinoFlux(){}
     atmosNeutrinoFlux(nuflux::FluxFunction* f, bool nugen_compatible = false):flux(f),nugen_compatible(nugen_compatible){}
     atmosNeutrinoFlux(std::shared_ptr<nuflux::FluxFunction> f, bool nugen_compatible = false):flux(f),nugen_compatible(nugen_compatible){}
     atmosNeutrinoFlux(boost::shared_ptr<nuflux::FluxFunction> f, bool nugen_compatible = false):flux(to_std_ptr(f)),nugen_compatible(nugen_compatible){}
     double EvaluateFlux(const Event& e) const;
+    double EvaluateFlux(const PreparedEvent& e) const;
+    void EvaluateFluxBatch(const Event * events, size_t n, double * out) const override;
     double operator()(const Event& e) const{
       return EvaluateFlux(e);
     }
+    double operator()(const PreparedEvent& e) const{
+      return EvaluateFlux(e);
+    }
     std::shared_ptr<nuflux::FluxFunction> get(){
       return(flux);
     }
+    ///\brief Tabulates the flux per primary type in log10(E/GeV) and cos(zenith) and uses the table from then on
+    std::shared_ptr<const TabulatedFlux> enable_table(double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+        unsigned int n_cos_zenith = 41, double tolerance = 1.e-3);
+    ///\brief Uses the given table, e.g. one from TabulatedFlux::Open; null goes back to the nuflux flux
+    void enable_table(std::shared_ptr<const TabulatedFlux> t){
+      table = t;
+    }
+    std::shared_ptr<const TabulatedFlux> get_table() const {
+      return table;
+    }
   };
 }// namespace LW
 
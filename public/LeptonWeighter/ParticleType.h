@@ -174,6 +174,9 @@ enum class ParticleType {
 
 std::ostream& operator<<(std::ostream& os, ParticleType& pt);
 
+/// whether p is a charged lepton or antilepton
+bool is_charged_lepton(ParticleType p);
+
 } // namespace LW
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef LW_PHASESPACEINDEX_H
+#define LW_PHASESPACEINDEX_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
+#include "Event.h"
+#include "Generator.h"
+
+namespace LW {
+
+///\class
+///\brief Lookup of the generators whose phase space contains an event
+///\details Generators are bucketed by their unordered pair of final state particles. Inside a
+/// bucket the energy axis is cut at every generator energy bound into elementary intervals:
+/// the bounds themselves and the open ranges between them. Each interval stores the generators
+/// covering it, so a lookup is a hash, a binary search and a copy-free return of the
+/// candidates, independent of the total number of generators.
+/// Only RangeGenerator and VolumeGenerator are indexed. Generators of any other type are
+/// returned for every event, since their acceptance is not known.
+class PhaseSpaceIndex {
+    private:
+        struct Bucket {
+            // sorted distinct energy bounds
+            std::vector<double> bounds;
+            // candidates for bound k at 2k, for the open range above bound k at 2k+1,
+            // and below the first bound at the end
+            std::vector<std::vector<size_t>> candidates;
+        };
+        std::unordered_map<uint64_t,Bucket> buckets;
+        // generators that are candidates for every event
+        std::vector<size_t> always;
+        // every generator, for events that cannot be looked up
+        std::vector<size_t> all;
+    private:
+        static uint64_t final_state_key(ParticleType final_state_particle_0, ParticleType final_state_particle_1);
+    public:
+        ///\brief Constructor. Generator indices refer to positions in gv.
+        explicit PhaseSpaceIndex(const std::vector<std::shared_ptr<Generator>> & gv);
+        ///\brief Returns the indices of the generators that can have produced e, in increasing order.
+        ///\details Every generator left out has zero probability for e.
+        const std::vector<size_t> & candidates(const Event & e) const;
+        ///\brief Number of generators the index was built with
+        size_t size() const { return all.size();}
+};
+
+} // namespace LW
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef LW_PREPAREDEVENT_H
+#define LW_PREPAREDEVENT_H
+
+#include <LeptonWeighter/Event.h>
+
+namespace LW {
+
+///\class
+///\brief Event together with the derived quantities several weighting components need
+///\details The logarithms of the cross section variables, the cosine of the zenith angle and the
+/// interaction channel are computed once, when the PreparedEvent is built, instead of in every
+/// flux and cross section. Their overloads taking a PreparedEvent read these values, with results
+/// identical to passing the plain Event. The Generator overloads take the plain fields of event,
+/// and a compiled Weighter reads the logarithms for the library generators. A PreparedEvent converts
+/// to its Event, so it works everywhere else a single Event does. It holds the Event instead of
+/// deriving from it so that an array of PreparedEvents cannot be passed by mistake to the batch
+/// functions, which take arrays of Events. After changing a field of event call prepare again.
+class PreparedEvent {
+    public:
+        /// the event the quantities below are derived from
+        Event event;
+
+        /// log10 of energy, interaction_x and interaction_y
+        double log10_energy;
+        double log10_interaction_x;
+        double log10_interaction_y;
+
+        /// cosine of the zenith angle
+        double cos_zenith;
+
+        /// whether the primary is a neutrino or an antineutrino; neither for other particles
+        bool neutrino;
+        bool antineutrino;
+        /// whether a final state particle is a charged lepton
+        bool charged_current;
+    public:
+        PreparedEvent() {}
+        ///\brief Copies e and computes the derived quantities
+        explicit PreparedEvent(const Event & e): event(e) { prepare(); }
+        ///\brief Recomputes the derived quantities from the fields of event
+        void prepare();
+        operator const Event & () const { return event;}
+};
+
+} // namespace LW
+
+#endif
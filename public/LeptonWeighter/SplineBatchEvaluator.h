@@ -0,0 +1,103 @@
+#ifndef LW_SPLINEBATCHEVALUATOR_H
+#define LW_SPLINEBATCHEVALUATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <photospline/splinetable.h>
+
+namespace LW {
+
+///\brief Arithmetic the batch spline evaluation runs in
+enum class SplinePrecision {Double, Single};
+
+///\class
+///\brief Accuracy of single precision evaluation against double precision
+struct SinglePrecisionAccuracy {
+    /// number of values compared
+    size_t n_samples = 0;
+    /// largest and mean relative deviation from the double precision values
+    double max_relative_error = 0;
+    double mean_relative_error = 0;
+    /// whether the deviation stayed within the tolerance, so that single precision is used
+    bool accepted = false;
+};
+
+///\brief Distance between a and b in units in the last place, counted over the doubles between them
+uint64_t ulp_distance(double a, double b);
+
+///\class
+///\brief Evaluates a photospline table at many points at once
+///\details Points are processed in blocks of lanes. Inside a block every step, the basis
+/// functions and the tensor product contraction, is a loop over the lanes without dependencies
+/// between them, with the lane index running fastest in memory. The knots are located with the
+/// table's own searchcenters. Everything else repeats photospline's arithmetic operation by
+/// operation: the basis functions follow bsplvb_simple, with the knot distances and the recursion
+/// in double precision and the functions themselves stored as floats, and the contraction follows
+/// ndsplineeval_core, multiplying the float basis functions up from the first dimension and adding
+/// the (order+1)^ndim terms into a float sum in the same order. evaluate therefore returns exactly
+/// what ndsplineeval does, see max_ulp_difference. This holds as long as neither is compiled with
+/// -ffast-math or floating point contraction into FMA instructions.
+/// On x86 the kernels are compiled twice, for the baseline instruction set and for AVX2 without
+/// FMA, and the AVX2 version is used when the processor supports it, see uses_avx2. There is no
+/// AVX-512 version; a block of eight lanes of the float contraction fills one AVX2 register.
+/// Tables with more dimensions or a higher order than the kernel supports are evaluated point by
+/// point with ndsplineeval. The table must outlive the evaluator.
+/// evaluate_single also runs the basis recursion in single precision, over twice as many lanes.
+/// The coefficients are taken relative to the middle of their range, which the basis functions
+/// sum to one around, so that the single precision sum only carries the spread of the coefficients
+/// and not their offset. It is not bit for bit equal to ndsplineeval.
+class SplineBatchEvaluator {
+    public:
+        static const unsigned int lanes = 8;
+        static const unsigned int max_dimensions = 4;
+        static const unsigned int max_order = 5;
+        static const unsigned int single_lanes = 2*lanes;
+    private:
+        const photospline::splinetable<> * spline;
+        unsigned int ndim;
+        bool vectorized;
+        unsigned int order[max_dimensions];
+        const double * knots[max_dimensions];
+        unsigned int n_knots[max_dimensions];
+        uint64_t strides[max_dimensions];
+        const float * coefficients;
+        // middle of the coefficient range, subtracted in the single precision contraction
+        float coefficient_offset;
+    private:
+        // evaluates one block; Real is the type of the basis recursion, offset is subtracted from the coefficients
+        template<typename Real, unsigned int block_lanes>
+        void evaluate_block(const double * const * coordinates, size_t begin, size_t n, float offset, double * out, bool * in_range) const;
+        // evaluate_block over all points, for the baseline instruction set and for AVX2
+        template<typename Real, unsigned int block_lanes>
+        void evaluate_blocks(const double * const * coordinates, size_t n, float offset, double * out, bool * in_range) const;
+        template<typename Real, unsigned int block_lanes>
+        void evaluate_blocks_avx2(const double * const * coordinates, size_t n, float offset, double * out, bool * in_range) const;
+        void evaluate_pointwise(const double * const * coordinates, size_t n, double * out, bool * in_range) const;
+    public:
+        ///\brief Constructor. Reads the layout of the table once.
+        explicit SplineBatchEvaluator(const photospline::splinetable<> & spline);
+        ///\brief Evaluates the spline at n points, coordinates[d][i] being coordinate d of point i.
+        ///\details in_range[i] tells whether point i is inside the table; out[i] is only written if it is.
+        void evaluate(const double * const * coordinates, size_t n, double * out, bool * in_range) const;
+        ///\brief Same as evaluate in single precision. Tables that are not vectorized are evaluated with ndsplineeval.
+        void evaluate_single(const double * const * coordinates, size_t n, double * out, bool * in_range) const;
+        ///\brief Dispatches to evaluate or evaluate_single
+        void evaluate(const double * const * coordinates, size_t n, double * out, bool * in_range, SplinePrecision precision) const {
+            if(precision == SplinePrecision::Single)
+                evaluate_single(coordinates,n,out,in_range);
+            else
+                evaluate(coordinates,n,out,in_range);
+        }
+        ///\brief Largest difference in ulps between evaluate and ndsplineeval over the points inside the table
+        ///\details Zero unless photospline or this library was built with different floating point options.
+        uint64_t max_ulp_difference(const double * const * coordinates, size_t n) const;
+        ///\brief Whether the blocks run in the AVX2 version of the kernels
+        static bool uses_avx2();
+        ///\brief Returns false if the table is evaluated with ndsplineeval
+        bool is_vectorized() const { return vectorized;}
+        const photospline::splinetable<> & get_spline() const { return *spline;}
+};
+
+} // namespace LW
+
+#endif
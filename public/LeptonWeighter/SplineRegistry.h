@@ -0,0 +1,67 @@
+#ifndef LW_SPLINEREGISTRY_H
+#define LW_SPLINEREGISTRY_H
+
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <photospline/splinetable.h>
+
+namespace LW {
+
+///\class
+///\brief Lookup counts of a SplineRegistry
+struct SplineRegistryStatistics {
+    /// lookups answered with a spline already in memory
+    size_t hits = 0;
+    /// lookups that had to read the FITS data, including ones that lost a race to store it
+    size_t misses = 0;
+    /// distinct splines currently alive
+    size_t resident = 0;
+};
+
+///\class
+///\brief Process wide cache of splines keyed by the content of their FITS data
+///\details Every lookup hashes the FITS bytes; data seen before is answered with the spline that
+/// was read from it, as long as someone still holds that spline. The registry only keeps weak
+/// references, so a spline is freed as soon as its last user is, and memory grows with the
+/// number of distinct tables in use instead of the number of LIC blocks or cross section objects
+/// that name them. The key is the size of the data together with two independent 64 bit hashes;
+/// the bytes themselves are not kept. The map is guarded by a mutex that is not held while FITS
+/// data is read, so threads reading different tables parse them in parallel. Threads that read the
+/// same new table at once may each parse it, but all of them get the spline stored first.
+class SplineRegistry {
+    public:
+        using splinetable=photospline::splinetable<>;
+    private:
+        using Key=std::tuple<uint64_t,uint64_t,uint64_t>;
+        mutable std::mutex mutex;
+        std::map<Key,std::weak_ptr<const splinetable>> splines;
+        size_t hits = 0;
+        size_t misses = 0;
+    private:
+        static Key content_key(const char * data, size_t size);
+        // the live spline stored under key, or null; the caller holds the mutex
+        std::shared_ptr<const splinetable> find(const Key & key) const;
+    public:
+        SplineRegistry() {}
+        SplineRegistry(const SplineRegistry &) = delete;
+        SplineRegistry & operator=(const SplineRegistry &) = delete;
+        ///\brief The registry the library reads its splines through
+        static SplineRegistry & global();
+        ///\brief Returns the spline stored in the FITS data, reading it only if no live spline has the same content
+        std::shared_ptr<const splinetable> get(const char * data, size_t size);
+        std::shared_ptr<const splinetable> get(const std::vector<char> & fits_data){ return get(fits_data.data(),fits_data.size());}
+        ///\brief Same as above for a FITS file. Returns a null pointer if the file cannot be read.
+        std::shared_ptr<const splinetable> get_file(const std::string & path);
+        ///\brief Lookup counts since construction or the last reset_statistics
+        SplineRegistryStatistics get_statistics() const;
+        void reset_statistics();
+};
+
+} // namespace LW
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef LW_TABULATEDCROSSSECTION_H
+#define LW_TABULATEDCROSSSECTION_H
+
+#include <vector>
+#include <memory>
+#include "ParticleType.h"
+#include "GridInterpolation.h"
+#include "CrossSection.h"
+
+namespace LW {
+
+///\class
+///\brief Cross section interpolated from a grid of samples of another cross section
+///\details The wrapped cross section is sampled once, on a grid regular in log10(E), log10(x)
+/// and log10(y), for four channels: neutrino and antineutrino, charged and neutral current. The
+/// channel of an event is chosen as in CrossSectionFromSpline and sampled with the muon flavor.
+/// Between nodes the logarithm of the cross section is interpolated trilinearly or with
+/// tricubic Catmull-Rom splines, without branches on the data. When the table is built, the
+/// interpolation at the center of every cell is checked against the wrapped cross section; cells
+/// that miss the tolerance or touch a node where the cross section is not positive are not used.
+/// Neither are cells where, at a corner or the center, another flavor or final state of the same
+/// channel, including the Glashow resonance final states of the anti electron neutrino, has a
+/// cross section that differs from the muon one by more than the tolerance, so that a cross
+/// section that depends on the flavor, as the Glashow resonance does, is left to the wrapped one.
+/// Events in those cells, outside the grid or with a primary that is not a neutrino are passed on
+/// to the wrapped cross section.
+class TabulatedCrossSection: public CrossSection {
+    public:
+        enum class Interpolation {Linear, Cubic};
+    private:
+        std::shared_ptr<const CrossSection> cs;
+        double log10_energy_min, log10_energy_max;
+        double log10_x_min, log10_x_max;
+        double log10_y_min, log10_y_max;
+        unsigned int n_energy, n_x, n_y;
+        Interpolation interpolation;
+        // log of the node values, NaN where the value is not positive; channels in the order
+        // nu CC, nubar CC, nu NC, nubar NC, then energy, x and y, y running fastest
+        std::vector<double> log_values;
+        // cells whose center agrees with the wrapped cross section within the tolerance
+        std::vector<char> cell_trusted;
+        size_t n_trusted_cells;
+        size_t n_flavor_dependent_cells;
+    private:
+        size_t node(unsigned int channel, unsigned int i, unsigned int j, unsigned int k) const {
+            return ((static_cast<size_t>(channel)*n_energy+i)*n_x+j)*n_y+k;
+        }
+        size_t cell(unsigned int channel, unsigned int i, unsigned int j, unsigned int k) const {
+            return ((static_cast<size_t>(channel)*(n_energy-1)+i)*(n_x-1)+j)*(n_y-1)+k;
+        }
+        double interpolate(unsigned int channel, unsigned int i, unsigned int j, unsigned int k, double fi, double fj, double fk) const;
+        bool evaluate_log(unsigned int channel, double log10_energy, double log10_x, double log10_y, double & cross_section) const;
+        static bool find_channel(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1, unsigned int & channel);
+    public:
+        ///\brief Constructor. Evaluates the wrapped cross section at every node and cell center.
+        ///@param cs cross section to tabulate
+        ///@param n_energy number of nodes in log10(E/GeV) between log10_energy_min and log10_energy_max, and so on
+        ///@param tolerance largest relative error accepted at a cell center, and largest relative difference between the
+        /// flavors and final states of a channel. Zero or less only rejects cells next to non-positive nodes or where they differ at all.
+        TabulatedCrossSection(std::shared_ptr<const CrossSection> cs,
+                double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+                double log10_x_min, double log10_x_max, unsigned int n_x,
+                double log10_y_min, double log10_y_max, unsigned int n_y,
+                Interpolation interpolation = Interpolation::Cubic,
+                double tolerance = 1.e-3);
+        ///\brief Interpolates the table. Returns false if the event is not tabulated.
+        bool evaluate(ParticleType primary, ParticleType final_state_particle_0, ParticleType final_state_particle_1,
+                double energy, double x, double y, double & cross_section) const;
+        ///\brief Returns the double differential cross section, from the table where it can.
+        double DoubleDifferentialCrossSection(ParticleType pt, ParticleType finalstate_0, ParticleType finalstate_1, double energy, double x, double y) const override;
+        ///\brief Same as above, locating the event with the logarithms cached in it.
+        double DoubleDifferentialCrossSection(const PreparedEvent & e) const override;
+        ///\brief Batch version; the events the table cannot answer are passed on in one batch.
+        void DoubleDifferentialCrossSectionBatch(const Event * events, size_t n, double * out) const override;
+        ///\brief Compares the table to the wrapped cross section at n_samples random points inside the grid
+        ///\details The points are spread over all neutrino flavors, charged and neutral current.
+        TableAccuracy validate(unsigned int n_samples, unsigned int seed = 0) const;
+        ///\brief Fraction of the cells that passed the tolerance check
+        double trusted_fraction() const { return static_cast<double>(n_trusted_cells)/cell_trusted.size();}
+        ///\brief Fraction of the cells rejected because the cross section depends on the flavor or final state there
+        double flavor_dependent_fraction() const { return static_cast<double>(n_flavor_dependent_cells)/cell_trusted.size();}
+        ///\brief Cross section the table was built from
+        std::shared_ptr<const CrossSection> get_cross_section() const { return cs;}
+};
+
+} // namespace LW
+
+#endif
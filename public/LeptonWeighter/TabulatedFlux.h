@@ -0,0 +1,108 @@
+#ifndef LW_TABULATEDFLUX_H
+#define LW_TABULATEDFLUX_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "ParticleType.h"
+#include "GridInterpolation.h"
+#include "Event.h"
+#include "PreparedEvent.h"
+#include "Flux.h"
+
+namespace LW {
+
+///\class
+///\brief Flux interpolated from a grid of samples of another flux
+///\details The wrapped flux is sampled once for each of the six neutrino types, on a grid regular
+/// in log10(E) and cos(zenith), so it is assumed not to depend on the azimuth or the interaction,
+/// as the atmospheric fluxes do not. Between nodes the logarithm of the flux is interpolated with
+/// bicubic Catmull-Rom splines. When the table is built, the interpolation at the center of every
+/// cell is checked against the wrapped flux; cells that miss the tolerance or touch a node where the
+/// flux is not positive are not used. Events in those cells, outside the grid or with a primary that
+/// is not a neutrino are passed on to the wrapped flux. The tables are shared between copies and are
+/// never modified, so the object is safe to share between threads as long as the wrapped flux is.
+///
+/// write stores the table in a binary file that Open maps into memory, so that every process on a
+/// machine reading the same file shares one copy in the page cache. The file holds a 120 byte header,
+/// the node logarithms as doubles from byte 128 on and one byte per cell telling if it is trusted.
+/// The header holds the magic "LWFLUXT", the format version, a byte order mark, the grid and the
+/// FNV-1a checksums of the header, the nodes and the cells. Numbers are in the byte order of the
+/// machine that wrote the file; other machines refuse it. A table opened without a flux to fall back
+/// to interpolates the cells that failed the tolerance check anyway, returns zero where a node is not
+/// positive and throws for events outside the grid or with a primary that is not a neutrino.
+class TabulatedFlux: public Flux {
+    private:
+        std::shared_ptr<const Flux> flux;
+        double log10_energy_min, log10_energy_max;
+        double cos_zenith_min, cos_zenith_max;
+        unsigned int n_energy, n_cos_zenith;
+        // keeps the memory behind log_values and cell_trusted alive
+        std::shared_ptr<const void> storage;
+        // log of the node values, NaN where the value is not positive; neutrino types in the order
+        // NuE, NuMu, NuTau, NuEBar, NuMuBar, NuTauBar, then energy, cos(zenith) running fastest
+        const double * log_values;
+        // cells whose center agrees with the wrapped flux within the tolerance
+        const char * cell_trusted;
+        size_t n_trusted_cells;
+    private:
+        size_t node(unsigned int flavor, unsigned int i, unsigned int j) const {
+            return (static_cast<size_t>(flavor)*n_energy+i)*n_cos_zenith+j;
+        }
+        size_t cell(unsigned int flavor, unsigned int i, unsigned int j) const {
+            return (static_cast<size_t>(flavor)*(n_energy-1)+i)*(n_cos_zenith-1)+j;
+        }
+        size_t number_of_cells() const { return static_cast<size_t>(n_flavors)*(n_energy-1)*(n_cos_zenith-1);}
+        double interpolate(unsigned int flavor, unsigned int i, unsigned int j, double fi, double fj) const;
+        bool locate_point(double log10_energy, double cos_zenith, unsigned int & i, unsigned int & j, double & fi, double & fj) const;
+        bool evaluate_log(unsigned int flavor, double log10_energy, double cos_zenith, double & flux) const;
+        // flux of an event the table does not answer, from the wrapped flux if there is one
+        double untabulated_flux(const Event & e) const;
+        TabulatedFlux() {}
+    public:
+        ///\brief Number of neutrino types the table holds
+        static const unsigned int n_flavors = 6;
+        ///\brief Version of the file format write produces
+        static const uint32_t file_format_version = 1;
+        ///\brief Index of a neutrino type in the table. Returns false for other particles.
+        static bool flavor_index(ParticleType primary, unsigned int & flavor);
+        ///\brief Constructor. Evaluates the wrapped flux at every node and cell center.
+        ///@param flux flux to tabulate
+        ///@param n_energy number of nodes in log10(E/GeV) between log10_energy_min and log10_energy_max, and so on
+        ///@param tolerance largest relative error accepted at a cell center. Zero or less only rejects cells next to non-positive nodes.
+        TabulatedFlux(std::shared_ptr<const Flux> flux,
+                double log10_energy_min, double log10_energy_max, unsigned int n_energy,
+                double cos_zenith_min = -1., double cos_zenith_max = 1., unsigned int n_cos_zenith = 41,
+                double tolerance = 1.e-3);
+        using Flux::EvaluateFlux;
+        ///\brief Interpolates the table. Returns false if the point is not tabulated.
+        bool evaluate(ParticleType primary, double energy, double cos_zenith, double & flux) const;
+        ///\brief Returns the flux, from the table where it can.
+        result_type EvaluateFlux(const Event & e) const override;
+        ///\brief Same as above, with the logarithm and the cosine cached in the event.
+        result_type EvaluateFlux(const PreparedEvent & e) const override;
+        ///\brief Batch version; the events the table cannot answer are passed on in one batch.
+        void EvaluateFluxBatch(const Event * events, size_t n, double * out) const override;
+        ///\brief Writes the table to a file that Open reads
+        ///\details The file is written under a unique temporary name next to path, synced to disk and
+        /// renamed, so readers never see it half written and concurrent writers do not collide. It gets
+        /// the permissions the process umask leaves of 0666, like any other new file.
+        void write(const std::string & path) const;
+        ///\brief Maps a table written by write into memory
+        ///@param path file to read
+        ///@param flux flux for the events the table does not answer; may be null, see the class description
+        ///@param verify_checksums whether to check the nodes and cells against their checksums, which reads the whole file once
+        static std::shared_ptr<TabulatedFlux> Open(const std::string & path, std::shared_ptr<const Flux> flux = nullptr, bool verify_checksums = true);
+        ///\brief Compares the table to the wrapped flux at n_samples random points inside the grid
+        ///\details The points are spread over the six neutrino types. Throws if there is no wrapped flux.
+        TableAccuracy validate(unsigned int n_samples, unsigned int seed = 0) const;
+        ///\brief Fraction of the cells that passed the tolerance check
+        double trusted_fraction() const { return static_cast<double>(n_trusted_cells)/number_of_cells();}
+        ///\brief Flux the table falls back to, null for a file opened without one
+        std::shared_ptr<const Flux> get_flux() const { return flux;}
+};
+
+} // namespace LW
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef LW_THREADPOOL_H
+#define LW_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LW {
+
+///\class
+///\brief Fixed size work-stealing thread pool
+///\details Tasks are indices in [0,n_tasks). They are dealt out in contiguous
+/// runs to one queue per participant; a participant that runs dry steals from
+/// the back of the other queues, so uneven task costs get balanced without a
+/// central queue. The calling thread takes part in the work.
+class ThreadPool {
+    private:
+        struct WorkQueue {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+        std::vector<std::thread> workers;
+        // one queue per participant, index 0 belongs to the calling thread
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        // serializes concurrent calls to parallel_for
+        std::mutex call_mutex;
+        // job hand off to the workers
+        std::mutex job_mutex;
+        std::condition_variable job_cv;
+        std::condition_variable done_cv;
+        const std::function<void(size_t)> * job = nullptr;
+        unsigned long job_generation = 0;
+        unsigned int finished_workers = 0;
+        bool stop = false;
+        // first exception thrown by a task
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        std::atomic<bool> failed;
+    private:
+        void worker_loop(unsigned int id);
+        void run_tasks(unsigned int id);
+        bool next_task(unsigned int id, size_t & task);
+    public:
+        ///\brief Constructor
+        ///@param n_threads total number of threads including the caller. Zero means one per hardware thread.
+        explicit ThreadPool(unsigned int n_threads = 0);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool & operator=(const ThreadPool &) = delete;
+        ///\brief Number of threads doing work, including the caller.
+        unsigned int size() const { return queues.size(); }
+        ///\brief Calls task(i) for every i in [0,n_tasks) and blocks until all are done.
+        ///\details If tasks throw, the remaining tasks are abandoned and the first exception is rethrown here.
+        void parallel_for(size_t n_tasks, const std::function<void(size_t)> & task);
+};
+
+} // namespace LW
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef LW_WEIGHTSTATUS_H
+#define LW_WEIGHTSTATUS_H
+
+#include <cstddef>
+
+namespace LW {
+
+///\brief Outcome of weighting one event in the non-throwing batch mode
+enum class WeightStatus : unsigned char {
+    /// the weight is valid
+    OK = 0,
+    /// no generator could have produced the event
+    OutOfPhaseSpace,
+    /// a generator interaction spline could not be evaluated at the event
+    SplineOutOfRange,
+    /// the cross section does not handle the primary particle type
+    BadParticleType,
+    /// a flux, cross section or generator threw
+    Failed
+};
+
+///\brief Returns the name of a status
+inline const char * to_string(WeightStatus status){
+    switch(status){
+        case WeightStatus::OK: return "OK";
+        case WeightStatus::OutOfPhaseSpace: return "OutOfPhaseSpace";
+        case WeightStatus::SplineOutOfRange: return "SplineOutOfRange";
+        case WeightStatus::BadParticleType: return "BadParticleType";
+        default: return "Failed";
+    }
+}
+
+///\class
+///\brief Number of events that ended up with each status
+struct WeightStatusCounts {
+    size_t ok = 0;
+    size_t out_of_phase_space = 0;
+    size_t spline_out_of_range = 0;
+    size_t bad_particle_type = 0;
+    size_t failed = 0;
+
+    void add(WeightStatus status){
+        switch(status){
+            case WeightStatus::OK: ok++; break;
+            case WeightStatus::OutOfPhaseSpace: out_of_phase_space++; break;
+            case WeightStatus::SplineOutOfRange: spline_out_of_range++; break;
+            case WeightStatus::BadParticleType: bad_particle_type++; break;
+            default: failed++;
+        }
+    }
+    ///\brief Number of events counted
+    size_t total() const { return ok+out_of_phase_space+spline_out_of_range+bad_particle_type+failed;}
+    ///\brief Number of events without a valid weight
+    size_t bad() const { return total()-ok;}
+};
+
+} // namespace LW
+
+#endif
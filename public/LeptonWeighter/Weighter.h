@@ -7,7 +7,16 @@
 #include "Flux.h"
 #include "CrossSection.h"
 #include "Event.h"
+#include "PreparedEvent.h"
 #include "Generator.h"
+#include "ThreadPool.h"
+#include "WeightingPlan.h"
+#include "WeightStatus.h"
+#include "EffectiveTauCrossSectionTable.h"
+#include "TabulatedCrossSection.h"
+#include "CompositeCrossSection.h"
+#include "TabulatedFlux.h"
+#include "SplineRegistry.h"
 
 #ifdef NUS_FOUND
 #include <nuSQuIDS/taudecay.h>
@@ -16,13 +25,88 @@
 
 namespace LW {
 
+///\class
+///\brief Columnar storage of the per event factors entering the weight
+///\details weight = total_flux*cross_section/generation_probability, evaluated in the same
+/// order as Weighter::weight, so recombining the columns reproduces it exactly.
+struct WeightComponents {
+    /// sum of all fluxes
+    std::vector<double> total_flux;
+    /// double differential cross section
+    std::vector<double> cross_section;
+    /// generation probability summed over all generators
+    std::vector<double> generation_probability;
+    /// generation probability of each generator, one column per generator. Only filled on request.
+    std::vector<std::vector<double>> generator_probability;
+
+    size_t size() const { return cross_section.size(); }
+    double weight(size_t i) const { return total_flux[i]*cross_section[i]/generation_probability[i]; }
+    double oneweight(size_t i) const { return cross_section[i]/generation_probability[i]; }
+};
+
+///\class
+///\brief Weights of one event sample under several flux hypotheses
+///\details Column major events-by-hypotheses matrix. Every distinct flux object used by the
+/// hypotheses is kept as its own column, so linear normalizations can be refit without
+/// evaluating the fluxes again.
+struct WeightMatrix {
+    /// distinct flux objects used by the hypotheses
+    std::vector<std::shared_ptr<Flux>> components;
+    /// for each hypothesis the indices of its fluxes in components
+    std::vector<std::vector<size_t>> hypothesis_components;
+    /// flux of each component, one column per component
+    std::vector<std::vector<double>> component_flux;
+    /// flux independent factors
+    std::vector<double> cross_section;
+    std::vector<double> generation_probability;
+    /// weights, one column per hypothesis
+    std::vector<std::vector<double>> weights;
+
+    size_t size() const { return cross_section.size(); }
+    double operator()(size_t event, size_t hypothesis) const { return weights[hypothesis][event]; }
+    double oneweight(size_t i) const { return cross_section[i]/generation_probability[i]; }
+    ///\brief Weights for the linear combination sum_k normalizations[k]*components[k]
+    std::vector<double> weight(const std::vector<double> & normalizations) const;
+};
+
 ///\class
 ///\brief Weighter class
+///\details Every const member function only reads the Weighter and the events it is given, so one
+/// Weighter can be used from many threads at once as long as its fluxes, cross section and
+/// generators can. All the components in this library can, see their documentation; setters,
+/// compile and set_effective_tau_table must not run concurrently with anything else.
 class Weighter: public MetaWeighter<Weighter>{
     private:
         std::vector<std::shared_ptr<Flux>> fv;
         std::shared_ptr<CrossSection> cs;
         std::vector<std::shared_ptr<Generator>> gv;
+        // devirtualized evaluation of the components above, see compile
+        std::shared_ptr<const WeightingPlan> plan;
+        // plan the non-throwing batch functions build for themselves while there is no compiled one;
+        // built by the first call and read and set atomically, as those calls may run concurrently
+        mutable std::shared_ptr<const WeightingPlan> status_plan;
+        // tabulated effective tau cross section, used when built from cs
+        std::shared_ptr<const EffectiveTauCrossSectionTable> tau_table;
+    private:
+        // number of events the batch functions keep in flight per component sweep
+        static const size_t batch_block_size = 1024;
+        // fills out with the summed generation probability and throws if any event was impossible
+        void get_generation_weight(const Event * events, size_t n, double * out) const;
+        // fills out with the double differential cross section
+        void get_cross_section(const Event * events, size_t n, double * out) const;
+        // single event functions, shared by Event and PreparedEvent
+        template<typename EventType>
+        double total_flux_of(const EventType & e) const;
+        template<typename EventType>
+        double weight_of(const EventType & e) const;
+        template<typename EventType>
+        double oneweight_of(const EventType & e) const;
+        // drops the compiled plan and the one cached for the non-throwing batch functions
+        void drop_plans(){ plan.reset(); status_plan.reset();}
+        // the compiled plan, or else the cached status_plan, building it on first use
+        std::shared_ptr<const WeightingPlan> get_status_plan() const;
+        // non-throwing batch weight, or oneweight if with_flux is false
+        WeightStatusCounts weight_with_status(const Event * events, size_t n, double * out, WeightStatus * status, bool with_flux) const;
     public:
         // cool constructors
         Weighter(
@@ -67,32 +151,116 @@ class Weighter: public MetaWeighter<Weighter>{
             if(flux_in.size() == 0)
                 throw std::runtime_error("Weighter::set_fluxes: Vector array null length");
             fv = flux_in;
+            drop_plans();
         }
         void add_flux(std::shared_ptr<Flux> f){
             fv.push_back(f);
+            drop_plans();
         }
         void set_cross_section(std::shared_ptr<CrossSection> cs_in){
             cs = cs_in;
+            drop_plans();
         }
         void add_generator(std::shared_ptr<Generator> g){
             gv.push_back(g);
+            drop_plans();
         }
         void set_generators(std::vector<std::shared_ptr<Generator>> gv_in){
             if(gv_in.size() == 0)
                 throw std::runtime_error("Weighter::set_generators: Vector array null length");
             gv=gv_in;
+            drop_plans();
         }
-        double get_total_flux(Event & e) const;
+        // looks up the concrete types of the fluxes, cross section and generators once and builds
+        // a WeightingPlan that every weighting function uses from then on. Known library types are
+        // called without virtual dispatch; results do not change, except that the batch functions then also
+        // evaluate the generator interaction splines in batches. Any setter drops the plan again.
+        void compile();
+        bool is_compiled() const { return static_cast<bool>(plan);}
+        std::shared_ptr<const WeightingPlan> get_plan() const { return plan;}
+        // compiles a plan that evaluates the cross section and generator interaction splines of the
+        // batch functions in single precision, see SplineBatchEvaluator::evaluate_single, and keeps it
+        // only if the batch weights of the given events, which should represent the sample, deviate
+        // from the double precision ones by at most tolerance. Otherwise the weighter stays as it was.
+        // The single event functions are not affected; compile and the setters go back to double precision.
+        // This plan is the only place single precision is switched on; an uncompiled weighter and
+        // CrossSectionFromSpline::DoubleDifferentialCrossSectionBatch always run in double precision.
+        SinglePrecisionAccuracy enable_single_precision(const Event * events, size_t n, double tolerance = 1.e-5);
+        SinglePrecisionAccuracy enable_single_precision(const std::vector<Event> & events, double tolerance = 1.e-5){
+            return enable_single_precision(events.data(),events.size(),tolerance);
+        }
+        bool is_single_precision() const { return plan and plan->get_precision() == SplinePrecision::Single;}
+        double get_total_flux(const Event & e) const;
         // most important function of all
-        double weight(Event & e) const;
+        double weight(const Event & e) const;
         // most important function of all so you can call it in two ways
-        double operator()(Event & e) const {return weight(e);}
+        double operator()(const Event & e) const {return weight(e);}
         // compatibility mode
-        double get_oneweight(Event & e) const;
+        double get_oneweight(const Event & e) const;
+        // same as above for a prepared event, whose cached logarithms, direction cosines and channel
+        // are used by every component instead of recomputing them. Results are identical.
+        double get_total_flux(const PreparedEvent & e) const;
+        double weight(const PreparedEvent & e) const;
+        double operator()(const PreparedEvent & e) const {return weight(e);}
+        double get_oneweight(const PreparedEvent & e) const;
+
+        // batch mode: each component is walked once per block of events instead of once per event, and
+        // the cross section splines are evaluated in batches, see SplineBatchEvaluator. Results are the
+        // same as calling the single event functions in a loop, unless single precision is enabled.
+        void get_total_flux(const Event * events, size_t n, double * out) const;
+        void weight(const Event * events, size_t n, double * out) const;
+        void get_oneweight(const Event * events, size_t n, double * out) const;
+        std::vector<double> get_total_flux(const std::vector<Event> & events) const;
+        std::vector<double> weight(const std::vector<Event> & events) const;
+        std::vector<double> get_oneweight(const std::vector<Event> & events) const;
+
+        // non-throwing batch mode: instead of throwing, every event gets a status and events that are
+        // not OK get a NaN weight. Returns how many events ended up with each status. Valid weights
+        // are the same as from the single event functions. Uses the compiled plan if there is one;
+        // otherwise the first call builds one for them, which is kept until a setter or compile runs.
+        WeightStatusCounts weight(const Event * events, size_t n, double * out, WeightStatus * status) const;
+        WeightStatusCounts get_oneweight(const Event * events, size_t n, double * out, WeightStatus * status) const;
+        WeightStatusCounts weight(const std::vector<Event> & events, std::vector<double> & out, std::vector<WeightStatus> & status) const;
+        WeightStatusCounts get_oneweight(const std::vector<Event> & events, std::vector<double> & out, std::vector<WeightStatus> & status) const;
+
+        // fills the weight factors in one pass without combining them. Unlike weight, this does not
+        // throw for events outside the generation phase space; their generation_probability is zero.
+        void get_weight_components(const Event * events, size_t n, WeightComponents & components, bool per_generator = false) const;
+        WeightComponents get_weight_components(const std::vector<Event> & events, bool per_generator = false) const;
+
+        // evaluates several flux hypotheses, each a list of fluxes that get summed, in one pass.
+        // The flux independent terms are computed once per event and every distinct flux once per
+        // event; each column equals what a Weighter built with that hypothesis returns.
+        WeightMatrix weight_matrix(const Event * events, size_t n, const std::vector<std::vector<std::shared_ptr<Flux>>> & hypotheses) const;
+        WeightMatrix weight_matrix(const std::vector<Event> & events, const std::vector<std::vector<std::shared_ptr<Flux>>> & hypotheses) const;
 
-        // effective tau weight
-        double get_effective_tau_oneweight(Event & e) const;
-        double get_effective_tau_weight(Event & e) const;
+        // weights together with their derivatives with respect to the flux parameters, see
+        // Flux::EvaluateFluxGradient. The parameters of all fluxes are concatenated in flux order and
+        // gradient is filled row major, n by get_number_of_flux_parameters(). The weights are the same
+        // as the ones from weight as long as each flux returns the same value from EvaluateFluxGradient
+        // as from EvaluateFluxBatch, as the library fluxes do.
+        unsigned int get_number_of_flux_parameters() const;
+        void weight_gradient(const Event * events, size_t n, double * weights, double * gradient) const;
+
+        // parallel batch mode: events are split in chunks of chunk_size that the pool threads
+        // balance by work stealing. Every event is weighted exactly as in the serial batch mode,
+        // so the output does not depend on the number of threads. All fluxes, the cross section and
+        // the generators must tolerate concurrent const calls.
+        void weight_parallel(const Event * events, size_t n, double * out, ThreadPool & pool, size_t chunk_size = 256) const;
+        void weight_parallel(const Event * events, size_t n, double * out, unsigned int n_threads = 0, size_t chunk_size = 256) const;
+        std::vector<double> weight_parallel(const std::vector<Event> & events, unsigned int n_threads = 0, size_t chunk_size = 256) const;
+
+        // effective tau weight. The effective cross section is interpolated from the table set with
+        // set_effective_tau_table when it was built from the current cross section and covers the event,
+        // and integrated otherwise.
+        void set_effective_tau_table(std::shared_ptr<const EffectiveTauCrossSectionTable> table){
+            tau_table = table;
+        }
+        std::shared_ptr<const EffectiveTauCrossSectionTable> get_effective_tau_table() const {
+            return tau_table;
+        }
+        double get_effective_tau_oneweight(const Event & e) const;
+        double get_effective_tau_weight(const Event & e) const;
 
 };
 
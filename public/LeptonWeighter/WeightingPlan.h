@@ -0,0 +1,149 @@
+#ifndef LW_WEIGHTINGPLAN_H
+#define LW_WEIGHTINGPLAN_H
+
+#include <vector>
+#include <memory>
+#include "Flux.h"
+#include "CrossSection.h"
+#include "Event.h"
+#include "PreparedEvent.h"
+#include "Generator.h"
+#include "PhaseSpaceIndex.h"
+#include "SplineBatchEvaluator.h"
+#include "WeightStatus.h"
+
+namespace LW {
+
+///\class
+///\brief Flattened evaluation plan for the components of a Weighter
+///\details The concrete type of every flux, cross section and generator is looked up once.
+/// Components of the library types PowerLawFlux, ConstantFlux, CrossSectionFromSpline,
+/// RangeGenerator and VolumeGenerator are then called directly, without virtual dispatch, and
+/// the generator normalizations are computed once instead of on every event. Any other type,
+/// including user classes deriving from the library ones, is evaluated through its virtual
+/// interface. Only the generators a PhaseSpaceIndex returns for an event are evaluated; the
+/// others have zero probability. Generators sharing the same cross section spline objects form a
+/// group whose interaction probability is evaluated once per event. The single event functions
+/// are bit-identical to the virtual evaluation. The column functions take the cross section from
+/// its DoubleDifferentialCrossSectionBatch, as a Weighter without a plan does, and evaluate the
+/// splines of each group for all events at once with a SplineBatchEvaluator, which returns the same
+/// values as photospline's ndsplineeval, so the columns match the single event functions. A plan built for single precision
+/// evaluates those splines, and the cross section splines of the column functions, with
+/// SplineBatchEvaluator::evaluate_single; its single event functions stay in double precision.
+/// The plan holds on to the components, but it does not see later changes made to a Weighter.
+class WeightingPlan {
+    public:
+        enum class TermKind {Virtual, ConstantFlux, PowerLawFlux, CrossSectionFromSpline, RangeGenerator, VolumeGenerator};
+    private:
+        struct FluxTerm {
+            TermKind kind;
+            const Flux * flux;
+        };
+        struct GeneratorTerm {
+            TermKind kind;
+            const Generator * generator;
+            // probability_e
+            double energy_min, energy_max, powerlaw_index, energy_norm;
+            // probability_dir
+            double zenith_min, zenith_max, azimuth_min, azimuth_max, direction_norm;
+            // probability_area and probability_stat
+            double area;
+            double number_of_events;
+            ParticleType final_state_particle_0, final_state_particle_1;
+            // probability_interaction, shared by all generators with the same splines
+            const photospline::splinetable<> * differential_spline;
+            const photospline::splinetable<> * total_spline;
+            size_t spline_group;
+        };
+        struct SplineGroup {
+            SplineBatchEvaluator differential;
+            SplineBatchEvaluator total;
+            SplineGroup(const photospline::splinetable<> & differential_spline, const photospline::splinetable<> & total_spline):
+                differential(differential_spline),total(total_spline){}
+        };
+        std::vector<std::shared_ptr<Flux>> fv;
+        std::shared_ptr<CrossSection> cs;
+        std::vector<std::shared_ptr<Generator>> gv;
+        std::vector<FluxTerm> flux_terms;
+        TermKind cross_section_kind;
+        std::vector<GeneratorTerm> generator_terms;
+        size_t n_spline_groups;
+        std::vector<SplineGroup> spline_groups;
+        SplinePrecision precision;
+        // generators that can contribute to a given event
+        PhaseSpaceIndex index;
+        // spline groups the scalar functions can memoize without allocating
+        static const size_t stack_spline_groups = 32;
+    private:
+        static GeneratorTerm make_generator_term(const Generator & g);
+        static double evaluate_flux(const FluxTerm & t, const Event & e);
+        static double evaluate_flux(const FluxTerm & t, const PreparedEvent & e);
+        // product of the energy, direction, area and position factors, zero as soon as one is
+        static double kinematic_probability(const GeneratorTerm & t, const Event & e);
+        // the same without the position factor of the volume generators
+        static double kinematic_probability_except_position(const GeneratorTerm & t, const Event & e);
+        // events of a block that need the position factor of one volume generator, and where
+        // their kinematic factors are
+        struct PositionRows {
+            std::vector<size_t> events;
+            std::vector<size_t> slots;
+        };
+        // multiplies the kinematic factors listed in rows, indexed by generator term, by the position
+        // factors of their generators, then empties rows
+        void apply_position_probability(const PositionColumns & positions, std::vector<PositionRows> & rows, double * kinematics) const;
+        static double final_state_probability(const GeneratorTerm & t, const Event & e);
+        // interaction points to the memo of the spline group of t; NaN means not evaluated yet.
+        // Returns false if the interaction splines cannot be evaluated at e.
+        template<typename EventType>
+        static bool evaluate_generator(const GeneratorTerm & t, const EventType & e, double & interaction, double & probability);
+        // interaction probability of the splines of t, from the cached logarithms for a PreparedEvent
+        static bool try_interaction_probability(const GeneratorTerm & t, const Event & e, double & probability);
+        static bool try_interaction_probability(const GeneratorTerm & t, const PreparedEvent & e, double & probability);
+        static bool is_neutrino(ParticleType pt);
+        template<typename EventType>
+        double generation_probability(const EventType & e, double * interaction) const;
+        template<typename EventType>
+        double generation_probability_of(const EventType & e) const;
+        WeightStatus try_generation_probability(const Event & e, double * interaction, double & out) const;
+        // interaction probability of spline group g for the events at the m given indices
+        void interaction_probability(size_t g, const Event * events, const size_t * indices, size_t m, double * out) const;
+    public:
+        ///\brief Constructor. Inspects the component types and precomputes the generator constants.
+        WeightingPlan(std::vector<std::shared_ptr<Flux>> fv,
+                std::shared_ptr<CrossSection> cs,
+                std::vector<std::shared_ptr<Generator>> gv,
+                SplinePrecision precision = SplinePrecision::Double);
+        ///\brief Sum of all fluxes
+        double total_flux(const Event & e) const;
+        ///\brief Double differential cross section
+        double cross_section(const Event & e) const;
+        ///\brief Generation probability summed over all generators
+        double generation_probability(const Event & e) const;
+        ///\brief Same as above, for prepared events
+        double total_flux(const PreparedEvent & e) const;
+        double cross_section(const PreparedEvent & e) const;
+        double generation_probability(const PreparedEvent & e) const;
+        ///\brief Column versions of the above. Each component is walked once over all n events, the cross
+        /// section through its batch function and the interaction splines in batches.
+        void total_flux(const Event * events, size_t n, double * out) const;
+        void cross_section(const Event * events, size_t n, double * out) const;
+        void generation_probability(const Event * events, size_t n, double * out) const;
+        ///\brief Non-throwing versions of total_flux, cross_section and generation_probability
+        ///\details out is only written when the status is OK, or OutOfPhaseSpace for the generation probability.
+        /// Exceptions from components without a devirtualized path are caught and reported as Failed.
+        WeightStatus try_total_flux(const Event & e, double & out) const;
+        WeightStatus try_cross_section(const Event & e, double & out) const;
+        WeightStatus try_generation_probability(const Event & e, double & out) const;
+        ///\brief Generation probability of the j-th generator alone
+        void generator_probability(size_t j, const Event * events, size_t n, double * out) const;
+        ///\brief Returns the number of distinct spline pairs among the devirtualized generators
+        size_t number_of_spline_groups() const { return n_spline_groups;}
+        ///\brief Arithmetic of the batch spline evaluation in the column functions
+        SplinePrecision get_precision() const { return precision;}
+        ///\brief Returns how many components are evaluated through virtual calls
+        unsigned int number_of_virtual_terms() const;
+};
+
+} // namespace LW
+
+#endif
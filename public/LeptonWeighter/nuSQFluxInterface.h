@@ -4,6 +4,8 @@
 #include <LeptonWeighter/Flux.h>
 #include <LeptonWeighter/ParticleType.h>
 #include <nuSQuIDS/nuSQuIDS.h>
+#include <mutex>
+#include <vector>
 
 namespace LW {
 
@@ -16,38 +18,87 @@ ParticleType Convert_nuSQuIDS_Id_To_PDG_Id(unsigned int flv, unsigned int neutyp
 ///\detail pair.first is the flavor and pair.second is neutype.
 std::pair<unsigned int, unsigned int> Convert_PDG_Id_To_nuSQuIDS_Id(ParticleType pt);
 
+///\class
+///\brief One event of a batch in nuSQuIDS terms
+struct nuSQuIDSEvaluationPoint {
+    unsigned int flavor;
+    unsigned int neutype;
+    double cos_zenith;
+    double energy;
+    /// position of the event in the batch
+    size_t index;
+};
+
+///\function
+///\brief Returns the events of a batch in the order the nuSQuIDS fluxes evaluate them
+///\details Events are grouped by flavor and neutrino type, as Convert_PDG_Id_To_nuSQuIDS_Id gives
+/// them, and sorted by cos(zenith) and energy within a group, so that consecutive EvalFlavor calls
+/// stay on the same state and interpolation nodes. Without sort_by_zenith the zenith is ignored.
+/// Throws for primaries that are not neutrinos before anything is evaluated.
+std::vector<nuSQuIDSEvaluationPoint> Order_For_nuSQuIDS_Evaluation(const Event * events, size_t n, bool sort_by_zenith);
+
 ///\class
 ///\brief nuSQUIDS atmospheric flux class
+///\details nuSQuIDS does not document its evaluation as reentrant, so concurrent EvaluateFlux calls
+/// on one object are serialized. Use one object per thread to evaluate in parallel.
+/// EvaluateFluxBatch takes the lock once and evaluates the events in the order of
+/// Order_For_nuSQuIDS_Evaluation, writing each result back to the position of its event. The values
+/// are those of EvaluateFlux, except that with atmospheric height randomization the random numbers
+/// are drawn in the new order.
 template<typename BaseType = nusquids::nuSQUIDS, typename = typename std::enable_if<std::is_base_of<nusquids::nuSQUIDS,BaseType>::value>::type >
 class nuSQUIDSAtmFlux: public Flux {
     private:
         const double GeV = 1.0e9;
         bool atmospheric_height_randomization = false;
+        mutable std::mutex evaluation_mutex;
     protected:
         nusquids::nuSQUIDSAtm<BaseType> nsqa;
     public:
         using result_type = double;
         result_type EvaluateFlux(const Event& e) const override {
           auto nusq_id = Convert_PDG_Id_To_nuSQuIDS_Id(e.primary_type);
+          std::lock_guard<std::mutex> lock(evaluation_mutex);
           return nsqa.EvalFlavor(nusq_id.first,cos(e.zenith),e.energy*GeV,nusq_id.second, atmospheric_height_randomization);
         };
+        result_type EvaluateFlux(const PreparedEvent& e) const override {
+          auto nusq_id = Convert_PDG_Id_To_nuSQuIDS_Id(e.event.primary_type);
+          std::lock_guard<std::mutex> lock(evaluation_mutex);
+          return nsqa.EvalFlavor(nusq_id.first,e.cos_zenith,e.event.energy*GeV,nusq_id.second, atmospheric_height_randomization);
+        };
+        void EvaluateFluxBatch(const Event * events, size_t n, double * out) const override {
+          const std::vector<nuSQuIDSEvaluationPoint> points = Order_For_nuSQuIDS_Evaluation(events,n,true);
+          std::lock_guard<std::mutex> lock(evaluation_mutex);
+          for(const auto& p : points)
+            out[p.index] = nsqa.EvalFlavor(p.flavor,p.cos_zenith,p.energy*GeV,p.neutype, atmospheric_height_randomization);
+        }
         explicit nuSQUIDSAtmFlux(const std::string & nusquids_data_file_path, bool atmospheric_height_randomization = false): nsqa(nusquids::nuSQUIDSAtm<BaseType>(nusquids_data_file_path)), atmospheric_height_randomization(atmospheric_height_randomization) {};
         explicit nuSQUIDSAtmFlux(nusquids::nuSQUIDSAtm<BaseType>&& nsqa, bool atmospheric_height_randomization = false): nsqa(std::move(nsqa)), atmospheric_height_randomization(atmospheric_height_randomization) {};
 };
 
 ///\class
 ///\brief nuSQUIDS flux class
+///\details Concurrent EvaluateFlux calls on one object are serialized, see nuSQUIDSAtmFlux. The batch
+/// version groups the events by flavor and neutrino type and sorts them by energy.
 class nuSQUIDSFlux: public Flux {
     private:
         const double GeV = 1.0e9;
+        mutable std::mutex evaluation_mutex;
     protected:
         nusquids::nuSQUIDS nsq;
     public:
         using result_type = double;
         result_type EvaluateFlux(const Event& e) const override {
           auto nusq_id = Convert_PDG_Id_To_nuSQuIDS_Id(e.primary_type);
+          std::lock_guard<std::mutex> lock(evaluation_mutex);
           return nsq.EvalFlavor(nusq_id.first,e.energy*GeV,nusq_id.second);
         };
+        void EvaluateFluxBatch(const Event * events, size_t n, double * out) const override {
+          const std::vector<nuSQuIDSEvaluationPoint> points = Order_For_nuSQuIDS_Evaluation(events,n,false);
+          std::lock_guard<std::mutex> lock(evaluation_mutex);
+          for(const auto& p : points)
+            out[p.index] = nsq.EvalFlavor(p.flavor,p.energy*GeV,p.neutype);
+        }
+        using Flux::EvaluateFlux;
         explicit nuSQUIDSFlux(const std::string & nusquids_data_file_path): nsq(nusquids::nuSQUIDS(nusquids_data_file_path)) {};
         explicit nuSQUIDSFlux(nusquids::nuSQUIDS&& nsq): nsq(std::move(nsq)) {};
 };
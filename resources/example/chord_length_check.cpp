@@ -0,0 +1,138 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include "LeptonWeighter/Weighter.h"
+
+//==============================================================================================
+//==============================================================================================
+
+// makes the scalar position functions of VolumeGenerator callable from here
+class CheckedVolumeGenerator: public LW::VolumeGenerator {
+    public:
+        using LW::VolumeGenerator::VolumeGenerator;
+        using LW::VolumeGenerator::get_eff_height;
+        using LW::VolumeGenerator::probability_pos;
+};
+
+// same bits, or both NaN
+bool identical(double a, double b){
+    if(std::isnan(a) and std::isnan(b))
+        return true;
+    uint64_t ia, ib;
+    std::memcpy(&ia,&a,sizeof(ia));
+    std::memcpy(&ib,&b,sizeof(ib));
+    return ia == ib;
+}
+
+LW::Event make_event(double x, double y, double z, double zenith, double azimuth){
+    LW::Event e;
+    e.x = x;
+    e.y = y;
+    e.z = z;
+    e.zenith = zenith;
+    e.azimuth = azimuth;
+    return e;
+}
+
+// Compares VolumeGenerator::get_eff_height_batch and probability_pos_batch with get_eff_height and
+// probability_pos bit for bit, for random vertices inside and outside the cylinder, vertices on and
+// one ulp around the endcaps and the side, and vertical, horizontal and random directions. Exits
+// with 1 on any difference.
+int main(int argc, char ** argv) {
+    if(argc>3)
+        throw std::runtime_error("usage: chord_length_check [n_random=100000] [seed=0]");
+
+    unsigned int n_random = (argc>1) ? std::stoul(argv[1]) : 100000;
+    unsigned int seed = (argc>2) ? std::stoul(argv[2]) : 0;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.,1.);
+    const double pi = M_PI;
+
+    size_t mismatches = 0;
+    // an IceCube sized cylinder, and a flat one on which most chords leave through the endcaps
+    for(auto geometry : {std::make_pair(800.,1000.), std::make_pair(1200.,100.)}){
+        const double radius = geometry.first;
+        const double height = geometry.second;
+        CheckedVolumeGenerator generator(LW::VolumeSimulationDetails(radius,height,
+                    1000,LW::ParticleType::MuMinus,LW::ParticleType::Hadrons,nullptr,nullptr,
+                    2018,0.,2*pi,0.,pi,1.e2,1.e6,2.));
+
+        std::vector<double> zeniths = {0.,pi,pi/2,std::nextafter(0.,1.),std::nextafter(pi,0.),std::nextafter(pi/2,0.),1.e-9,pi-1.e-9};
+        std::vector<double> azimuths = {0.,pi/2,pi,3*pi/2,std::nextafter(2*pi,0.),1.};
+        std::vector<double> edges_z, edges_r;
+        for(double edge : {-height/2, height/2}){
+            edges_z.push_back(std::nextafter(edge,-2*height));
+            edges_z.push_back(edge);
+            edges_z.push_back(std::nextafter(edge,2*height));
+        }
+        edges_z.push_back(0.);
+        edges_r = {0.,std::nextafter(radius,0.),radius,std::nextafter(radius,2*radius),2*radius};
+
+        std::vector<LW::Event> events;
+        size_t n_vertical = 0, n_outside = 0, n_endcap = 0;
+        // vertices on the grid of edges, in every special direction
+        for(double z : edges_z){
+            for(double r : edges_r){
+                for(double vertex_azimuth : {0.,pi/4,pi}){
+                    for(double zenith : zeniths){
+                        for(double azimuth : azimuths){
+                            events.push_back(make_event(r*cos(vertex_azimuth),r*sin(vertex_azimuth),z,zenith,azimuth));
+                            n_endcap += std::abs(std::abs(z)-height/2) <= height*1.e-15;
+                        }
+                    }
+                }
+            }
+        }
+        // random vertices in and around the cylinder, a tenth of them with vertical directions
+        for(unsigned int i=0; i<n_random; i++){
+            const double r = 1.5*radius*sqrt(uniform(rng));
+            const double vertex_azimuth = 2*pi*uniform(rng);
+            const double z = 1.5*height*(uniform(rng)-0.5);
+            const bool vertical = i%10 == 0;
+            const double zenith = vertical ? (i%20 == 0 ? 0. : pi) : acos(2*uniform(rng)-1);
+            events.push_back(make_event(r*cos(vertex_azimuth),r*sin(vertex_azimuth),z,zenith,2*pi*uniform(rng)));
+        }
+        for(const LW::Event& e : events){
+            n_vertical += sin(e.zenith) == 0;
+            n_outside += std::abs(e.z) > height/2 or sqrt(e.x*e.x+e.y*e.y) > radius;
+        }
+
+        LW::PositionColumns columns(events.data(),events.size());
+        std::vector<double> batch_height(events.size()), batch_probability(events.size());
+        generator.get_eff_height_batch(columns,batch_height.data());
+        generator.probability_pos_batch(columns,batch_probability.data());
+
+        size_t geometry_mismatches = 0;
+        for(size_t i=0; i<events.size(); i++){
+            const LW::Event& e = events[i];
+            const double scalar_height = generator.get_eff_height(e.x,e.y,e.z,e.zenith,e.azimuth);
+            const double scalar_probability = generator.probability_pos(e.x,e.y,e.z,e.zenith,e.azimuth);
+            if(identical(batch_height[i],scalar_height) and identical(batch_probability[i],scalar_probability))
+                continue;
+            if(geometry_mismatches < 10){
+                std::cout << std::setprecision(17) << "mismatch at x=" << e.x << " y=" << e.y << " z=" << e.z
+                    << " zenith=" << e.zenith << " azimuth=" << e.azimuth << ": height " << batch_height[i] << " vs " << scalar_height
+                    << ", probability " << batch_probability[i] << " vs " << scalar_probability << std::endl;
+            }
+            geometry_mismatches++;
+        }
+        std::cout << "Cylinder of radius " << radius << " m and height " << height << " m: " << events.size() << " vertices, "
+            << n_vertical << " vertical, " << n_outside << " outside, " << n_endcap << " on or next to an endcap; "
+            << geometry_mismatches << " mismatches" << std::endl;
+        mismatches += geometry_mismatches;
+    }
+
+    if(mismatches != 0){
+        std::cout << mismatches << " batch results differ from the scalar ones" << std::endl;
+        return 1;
+    }
+    std::cout << "Batch results identical to the scalar ones" << std::endl;
+    return 0;
+}
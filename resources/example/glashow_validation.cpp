@@ -0,0 +1,35 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "LeptonWeighter/Weighter.h"
+
+//==============================================================================================
+//==============================================================================================
+
+// Compares the closed form Glashow resonance cross section with the installed nuSQuIDS, at random
+// points across the resonance and on the grid enable_closed_form uses, and reports whether the
+// closed form would be accepted at the given tolerance. Exits with 1 if it would not.
+int main(int argc, char ** argv) {
+    if(argc>4)
+        throw std::runtime_error("usage: glashow_validation [n_samples=100000] [tolerance=1e-5] [seed=0]");
+
+    unsigned int n_samples = (argc>1) ? std::stoul(argv[1]) : 100000;
+    double tolerance = (argc>2) ? std::stod(argv[2]) : 1.e-5;
+    unsigned int seed = (argc>3) ? std::stoul(argv[3]) : 0;
+
+    LW::GlashowResonanceCrossSection gr;
+
+    for(auto range : {std::make_pair(1.e5,1.e8), std::make_pair(5.e6,8.e6)}){
+        LW::GlashowResonanceAccuracy accuracy = gr.validate(n_samples,range.first,range.second,seed);
+        std::cout << "Random points between " << range.first << " and " << range.second << " GeV: "
+            << accuracy.n_samples << " samples, largest relative error " << accuracy.max_relative_error
+            << ", mean " << accuracy.mean_relative_error << std::endl;
+    }
+
+    LW::GlashowResonanceAccuracy grid = gr.enable_closed_form(tolerance);
+    std::cout << "enable_closed_form grid: " << grid.n_samples << " points, largest relative error "
+        << grid.max_relative_error << ", mean " << grid.mean_relative_error << std::endl;
+    std::cout << "Closed form " << (grid.accepted ? "accepted" : "rejected") << " at a tolerance of " << tolerance << std::endl;
+
+    return grid.accepted ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <fstream>
+#include <boost/detail/endian.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/format.hpp>
+#include <boost/math/constants/constants.hpp>
+#include <memory>
+#include <vector>
+#include <map>
+#include <deque>
+#include <iterator>
+#include <set>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <LeptonWeighter/Weighter.h>
+
+//==============================================================================================
+//==============================================================================================
+
+#include "tableio.h"
+
+herr_t collectTableNames(hid_t group_id, const char * member_name, void* operator_data){
+    std::set<std::string>* items=static_cast<std::set<std::string>*>(operator_data);
+    items->insert(member_name);
+    return(0);
+}
+
+using Event=LW::Event;
+
+template<typename CallbackType>
+void readFile(const std::string& filePath, CallbackType action){
+    H5File h5file(filePath);
+    if(!h5file)
+        throw std::runtime_error("Unable to open "+filePath);
+    std::set<std::string> tables;
+    H5Giterate(h5file,"/",NULL,&collectTableNames,&tables);
+    if(tables.empty())
+        throw std::runtime_error(filePath+" contains no tables");
+#ifndef NO_STD_OUTPUT
+    std::cout << "Reading " << filePath << std::endl;
+#endif
+    std::map<RecordID,Event> intermediateData;
+
+    using particle = TableRow<field<double,CTS("totalEnergy")>,
+          field<double,CTS("zenith")>,
+          field<double,CTS("azimuth")>,
+          field<double,CTS("finalStateX")>,
+          field<double,CTS("finalStateY")>,
+          field<int,CTS("finalType1")>,
+          field<int,CTS("finalType2")>,
+          field<int,CTS("initialType")>,
+          field<double,CTS("totalColumnDepth")>,
+          field<double,CTS("radius")>,
+          field<double,CTS("z")>>;
+
+    if(tables.count("EventProperties")){
+        readTable<particle>(h5file, "EventProperties", intermediateData,
+                [](const particle& p, Event& e){
+                e.energy=p.get<CTS("totalEnergy")>();
+                e.zenith=p.get<CTS("zenith")>();
+                e.azimuth=p.get<CTS("azimuth")>();
+                e.interaction_x=p.get<CTS("finalStateX")>();
+                e.interaction_y=p.get<CTS("finalStateY")>();
+                e.final_state_particle_0=static_cast<LW::ParticleType>(p.get<CTS("finalType1")>());
+                e.final_state_particle_1=static_cast<LW::ParticleType>(p.get<CTS("finalType2")>());
+                e.primary_type=static_cast<LW::ParticleType>(p.get<CTS("initialType")>());
+                e.total_column_depth=p.get<CTS("totalColumnDepth")>();
+                e.radius=p.get<CTS("radius")>();
+                e.z=p.get<CTS("z")>();
+                });
+    }
+
+    for(std::map<RecordID,Event>::value_type& item : intermediateData)
+        action(item.first,item.second);
+}
+
+// Times Weighter::weight_parallel with 1 to max_threads threads and checks the weights against
+// the serial ones. Measured tables are collected in weight_scaling.md.
+int main(int argc, char ** argv) {
+    if(argc<7 or argc>9)
+        throw std::runtime_error("usage: weight_scaling configure.lic diff_nu_xs_CC diff_nu_xs_NC diff_antinu_xs_CC diff_antinu_xs_NC events_input_file.hdf5 [max_threads=64] [repetitions=3]");
+
+    std::string configuration_filename(argv[1]);
+    std::string diff_nu_CC_xs(argv[2]);
+    std::string diff_nu_NC_xs(argv[3]);
+    std::string diff_antinu_CC_xs(argv[4]);
+    std::string diff_antinu_NC_xs(argv[5]);
+    std::string input_filename(argv[6]);
+    unsigned int max_threads = (argc>7) ? std::stoul(argv[7]) : 64;
+    unsigned int repetitions = (argc>8) ? std::stoul(argv[8]) : 3;
+
+    std::vector<std::shared_ptr<LW::Generator>> generators = LW::MakeGeneratorsFromLICFile(configuration_filename);
+    std::shared_ptr<LW::CrossSectionFromSpline> xs = std::make_shared<LW::CrossSectionFromSpline>(diff_nu_CC_xs,diff_antinu_CC_xs,diff_nu_NC_xs,diff_antinu_NC_xs);
+    std::shared_ptr<LW::PowerLawFlux> flux = std::make_shared<LW::PowerLawFlux>(1.e-18,-2.);
+    LW::Weighter w(flux,xs,generators);
+
+    // read events from file, keeping only the ones inside the generation phase space
+    std::vector<Event> events;
+    try {
+        readFile(input_filename,
+                [&](RecordID id, Event& e){
+                try {
+                    w.weight(e);
+                    events.push_back(e);
+                } catch (std::runtime_error & ex) {}
+                }
+                );
+    } catch ( std::exception & ex){
+        std::cerr << ex.what() << std::endl;
+    }
+    if(events.empty())
+        throw std::runtime_error("No weightable events found in " + input_filename);
+
+    // serial reference
+    std::vector<double> reference = w.weight(events);
+
+    std::cout << "Weighting " << events.size() << " events, best of " << repetitions << " repetitions" << std::endl;
+    std::cout << "threads \t time/s \t events/s \t speedup \t efficiency \t identical" << std::endl;
+
+    double single_thread_time = 0;
+    for(unsigned int n_threads=1; n_threads<=max_threads; n_threads*=2){
+        LW::ThreadPool pool(n_threads);
+        std::vector<double> out(events.size());
+        double best_time = std::numeric_limits<double>::max();
+        for(unsigned int r=0; r<repetitions; r++){
+            auto start = std::chrono::steady_clock::now();
+            w.weight_parallel(events.data(),events.size(),out.data(),pool);
+            auto stop = std::chrono::steady_clock::now();
+            best_time = std::min(best_time,std::chrono::duration<double>(stop-start).count());
+        }
+        if(n_threads == 1)
+            single_thread_time = best_time;
+        double speedup = single_thread_time/best_time;
+        std::cout << n_threads << "\t" << std::setprecision(4) << best_time << "\t" << events.size()/best_time << "\t";
+        std::cout << speedup << "\t" << speedup/n_threads << "\t" << ((out == reference) ? "yes" : "no") << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include <iostream>
+#include <fstream>
+#include <boost/detail/endian.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/format.hpp>
+#include <boost/math/constants/constants.hpp>
+#include <memory>
+#include <vector>
+#include <map>
+#include <deque>
+#include <iterator>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
+#include <LeptonWeighter/Weighter.h>
+#ifdef NUS_FOUND
+#include <LeptonWeighter/nuSQFluxInterface.h>
+#endif
+
+//==============================================================================================
+//==============================================================================================
+
+#include "tableio.h"
+
+herr_t collectTableNames(hid_t group_id, const char * member_name, void* operator_data){
+    std::set<std::string>* items=static_cast<std::set<std::string>*>(operator_data);
+    items->insert(member_name);
+    return(0);
+}
+
+using Event=LW::Event;
+
+template<typename CallbackType>
+void readFile(const std::string& filePath, CallbackType action){
+    H5File h5file(filePath);
+    if(!h5file)
+        throw std::runtime_error("Unable to open "+filePath);
+    std::set<std::string> tables;
+    H5Giterate(h5file,"/",NULL,&collectTableNames,&tables);
+    if(tables.empty())
+        throw std::runtime_error(filePath+" contains no tables");
+#ifndef NO_STD_OUTPUT
+    std::cout << "Reading " << filePath << std::endl;
+#endif
+    std::map<RecordID,Event> intermediateData;
+
+    using particle = TableRow<field<double,CTS("totalEnergy")>,
+          field<double,CTS("zenith")>,
+          field<double,CTS("azimuth")>,
+          field<double,CTS("finalStateX")>,
+          field<double,CTS("finalStateY")>,
+          field<int,CTS("finalType1")>,
+          field<int,CTS("finalType2")>,
+          field<int,CTS("initialType")>,
+          field<double,CTS("totalColumnDepth")>,
+          field<double,CTS("radius")>,
+          field<double,CTS("z")>>;
+
+    if(tables.count("EventProperties")){
+        readTable<particle>(h5file, "EventProperties", intermediateData,
+                [](const particle& p, Event& e){
+                e.energy=p.get<CTS("totalEnergy")>();
+                e.zenith=p.get<CTS("zenith")>();
+                e.azimuth=p.get<CTS("azimuth")>();
+                e.interaction_x=p.get<CTS("finalStateX")>();
+                e.interaction_y=p.get<CTS("finalStateY")>();
+                e.final_state_particle_0=static_cast<LW::ParticleType>(p.get<CTS("finalType1")>());
+                e.final_state_particle_1=static_cast<LW::ParticleType>(p.get<CTS("finalType2")>());
+                e.primary_type=static_cast<LW::ParticleType>(p.get<CTS("initialType")>());
+                e.total_column_depth=p.get<CTS("totalColumnDepth")>();
+                e.radius=p.get<CTS("radius")>();
+                e.z=p.get<CTS("z")>();
+                });
+    }
+
+    for(std::map<RecordID,Event>::value_type& item : intermediateData)
+        action(item.first,item.second);
+}
+
+// Weighs events with w from n_threads threads at once, repetitions times each, through every const
+// entry point: single events, prepared events, batches, the status mode, the parallel mode and the
+// effective tau weight. Returns the number of results that differ from the serial ones, or of
+// batch results that differ from the single event ones.
+size_t stress(const LW::Weighter& w, const std::vector<Event>& events, unsigned int n_threads, unsigned int repetitions){
+    // serial references, one for the status mode and one for the batch functions, which should
+    // match the single event weights bit for bit
+    std::vector<double> reference;
+    std::vector<LW::WeightStatus> reference_status;
+    w.weight(events,reference,reference_status);
+    std::vector<Event> good;
+    std::vector<double> good_reference;
+    for(size_t i=0; i<events.size(); i++){
+        if(reference_status[i] == LW::WeightStatus::OK){
+            good.push_back(events[i]);
+            good_reference.push_back(reference[i]);
+        }
+    }
+    std::vector<double> batch_reference = w.weight(good);
+    std::cout << good.size() << " of " << events.size() << " events weightable" << std::endl;
+
+    size_t mismatches = 0;
+    uint64_t max_batch_difference = 0;
+    for(size_t i=0; i<good.size(); i++)
+        max_batch_difference = std::max(max_batch_difference,LW::ulp_distance(batch_reference[i],good_reference[i]));
+    if(max_batch_difference != 0){
+        std::cout << "batch weights differ from the single event ones by up to " << max_batch_difference << " ulps" << std::endl;
+        mismatches++;
+    }
+
+    // the prepared events should give the same weight, one weight and flux as the plain ones
+    std::vector<LW::PreparedEvent> prepared(good.begin(),good.end());
+    std::vector<double> oneweight_reference, flux_reference;
+    for(size_t i=0; i<good.size(); i++){
+        oneweight_reference.push_back(w.get_oneweight(good[i]));
+        flux_reference.push_back(w.get_total_flux(good[i]));
+        if(w.weight(prepared[i]) != good_reference[i] or w.get_oneweight(prepared[i]) != oneweight_reference[i] or
+                w.get_total_flux(prepared[i]) != flux_reference[i])
+            mismatches++;
+    }
+
+    // the effective tau weight integrates the cross section for every event, so only a few
+    // charged current muon neutrino events are taken
+    const size_t max_tau_events = 64;
+    std::vector<Event> tau_events;
+    std::vector<double> tau_reference;
+    for(const Event& e : good){
+        if(tau_events.size() == max_tau_events)
+            break;
+        if((e.primary_type == LW::ParticleType::NuMu or e.primary_type == LW::ParticleType::NuMuBar) and
+                (e.final_state_particle_0 == LW::ParticleType::MuMinus or e.final_state_particle_0 == LW::ParticleType::MuPlus)){
+            tau_events.push_back(e);
+            tau_reference.push_back(w.get_effective_tau_weight(e));
+        }
+    }
+
+    std::atomic<size_t> concurrent_mismatches(0);
+    std::vector<std::thread> threads;
+    for(unsigned int t=0; t<n_threads; t++){
+        threads.emplace_back([&,t](){
+            for(unsigned int r=0; r<repetitions; r++){
+                switch((t+r)%6){
+                    case 0: {
+                        for(size_t i=0; i<good.size(); i++){
+                            if(w.weight(good[i]) != good_reference[i])
+                                concurrent_mismatches++;
+                        }
+                        break;
+                    }
+                    case 1: {
+                        if(w.weight(good) != batch_reference)
+                            concurrent_mismatches++;
+                        break;
+                    }
+                    case 2: {
+                        std::vector<double> out;
+                        std::vector<LW::WeightStatus> status;
+                        w.weight(events,out,status);
+                        for(size_t i=0; i<events.size(); i++){
+                            if(status[i] != reference_status[i] or
+                                    (status[i] == LW::WeightStatus::OK and out[i] != reference[i]))
+                                concurrent_mismatches++;
+                        }
+                        break;
+                    }
+                    case 3: {
+                        for(size_t i=0; i<prepared.size(); i++){
+                            if(w(prepared[i]) != good_reference[i] or w.get_oneweight(prepared[i]) != oneweight_reference[i] or
+                                    w.get_total_flux(prepared[i]) != flux_reference[i])
+                                concurrent_mismatches++;
+                        }
+                        break;
+                    }
+                    case 4: {
+                        for(size_t i=0; i<tau_events.size(); i++){
+                            if(w.get_effective_tau_weight(tau_events[i]) != tau_reference[i])
+                                concurrent_mismatches++;
+                        }
+                        break;
+                    }
+                    default: {
+                        // nested pools: every stress thread runs its own workers
+                        if(w.weight_parallel(good,2,64) != batch_reference)
+                            concurrent_mismatches++;
+                    }
+                }
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    return mismatches+concurrent_mismatches;
+}
+
+// Weighs the same events with one shared Weighter from many threads at once, with a power law
+// flux and, when built with nuSQuIDS and given a flux file, with a nuSQuIDS flux, before and
+// after compiling the weighter. Checks that every result matches the serial one bit for bit, and
+// that the batch weights are the same as the single event ones. Build weight_stress_tsan.exe,
+// which compiles the library in with -fsanitize=thread, to also have data races reported.
+int main(int argc, char ** argv) {
+#ifdef NUS_FOUND
+    const int max_arguments = 10;
+#else
+    const int max_arguments = 9;
+#endif
+    if(argc<7 or argc>max_arguments)
+        throw std::runtime_error("usage: weight_stress configure.lic diff_nu_xs_CC diff_nu_xs_NC diff_antinu_xs_CC diff_antinu_xs_NC events_input_file.hdf5 [n_threads=16] [repetitions=20]"
+#ifdef NUS_FOUND
+                " [nusquids_flux_file.hdf5]"
+#endif
+                );
+
+    std::string configuration_filename(argv[1]);
+    std::string diff_nu_CC_xs(argv[2]);
+    std::string diff_nu_NC_xs(argv[3]);
+    std::string diff_antinu_CC_xs(argv[4]);
+    std::string diff_antinu_NC_xs(argv[5]);
+    std::string input_filename(argv[6]);
+    unsigned int n_threads = (argc>7) ? std::stoul(argv[7]) : 16;
+    unsigned int repetitions = (argc>8) ? std::stoul(argv[8]) : 20;
+
+    std::vector<std::shared_ptr<LW::Generator>> generators = LW::MakeGeneratorsFromLICFile(configuration_filename);
+    std::shared_ptr<LW::CrossSectionFromSpline> xs = std::make_shared<LW::CrossSectionFromSpline>(diff_nu_CC_xs,diff_antinu_CC_xs,diff_nu_NC_xs,diff_antinu_NC_xs);
+    std::vector<std::pair<std::string,std::shared_ptr<LW::Flux>>> fluxes;
+    fluxes.emplace_back("power law flux",std::make_shared<LW::PowerLawFlux>(1.e-18,-2.));
+#ifdef NUS_FOUND
+    if(argc>9)
+        fluxes.emplace_back("nuSQuIDS flux",std::make_shared<LW::nuSQUIDSAtmFlux<>>(std::string(argv[9])));
+#endif
+
+    // read all events; the ones outside the generation phase space exercise the status mode
+    std::vector<Event> events;
+    try {
+        readFile(input_filename,[&](RecordID id, Event& e){ events.push_back(e); });
+    } catch ( std::exception & ex){
+        std::cerr << ex.what() << std::endl;
+    }
+    if(events.empty())
+        throw std::runtime_error("No events found in " + input_filename);
+
+    size_t mismatches = 0;
+    for(const auto& flux : fluxes){
+        LW::Weighter w(flux.second,xs,generators);
+        for(bool compiled : {false, true}){
+            // the weighter may only be modified while no thread is using it
+            if(compiled)
+                w.compile();
+            std::cout << flux.first << (compiled ? ", compiled: " : ", uncompiled: ");
+            mismatches += stress(w,events,n_threads,repetitions);
+        }
+    }
+
+    if(mismatches != 0){
+        std::cout << mismatches << " results differ from the serial or the single event ones" << std::endl;
+        return 1;
+    }
+    std::cout << "All results identical to the serial ones" << std::endl;
+    return 0;
+}